@@ -0,0 +1,352 @@
+/* archive.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _ARCHIVE_HPP_
+#define _ARCHIVE_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* one member of an archive. name is as stored, '/' separated; utf8 tells its encoding, else the local code page */
+struct ArchiveEntry {
+    std::string name;
+    bool utf8 = false;
+    bool is_dir = false;
+    uint64_t size = 0; /* uncompressed */
+    int64_t mtime = 0;
+};
+
+/* whole file mapped read-only. only the pages actually touched are read */
+class MappedFile {
+   public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    const unsigned char* data() const { return base; }
+    std::size_t size() const { return bytes; }
+
+    bool open(const std::filesystem::path& p) {
+        close();
+#ifdef _WIN32
+        file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                           OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER sz;
+        if(!GetFileSizeEx(file, &sz) || sz.QuadPart == 0 || (uint64_t)sz.QuadPart > SIZE_MAX)
+            return false;
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping == NULL)
+            return false;
+        base = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        bytes = base ? (std::size_t)sz.QuadPart : 0;
+#else
+        fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size <= 0)
+            return false;
+        void* m = mmap(NULL, (std::size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(m == MAP_FAILED)
+            return false;
+        base = (const unsigned char*)m;
+        bytes = (std::size_t)st.st_size;
+#endif
+        return base != NULL;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if(base)
+            UnmapViewOfFile(base);
+        if(mapping)
+            CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        if(base)
+            munmap((void*)base, bytes);
+        if(fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        base = NULL;
+        bytes = 0;
+    }
+
+   private:
+    const unsigned char* base = NULL;
+    std::size_t bytes = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+namespace archive {
+
+inline uint16_t le16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+inline uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+inline uint64_t le64(const unsigned char* p) { return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32); }
+
+/* MS-DOS date and time, in local time like the archiver wrote them */
+inline int64_t dos_time(uint16_t date, uint16_t time) {
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    t.tm_year = (date >> 9) + 80;
+    t.tm_mon = ((date >> 5) & 15) - 1;
+    t.tm_mday = date & 31;
+    t.tm_hour = time >> 11;
+    t.tm_min = (time >> 5) & 63;
+    t.tm_sec = (time & 31) * 2;
+    t.tm_isdst = -1;
+    return (int64_t)mktime(&t);
+}
+
+/* tar numeric field: octal text, or base-256 when the high bit of the first byte is set */
+inline bool tar_number(const unsigned char* p, std::size_t len, uint64_t& v) {
+    v = 0;
+    if(p[0] & 0x80) {
+        for(std::size_t i = 0; i < len; ++i)
+            v = (v << 8) | (i == 0 ? (p[0] & 0x7f) : p[i]);
+        return true;
+    }
+    std::size_t i = 0;
+    while(i < len && p[i] == ' ')
+        ++i;
+    bool any = false;
+    for(; i < len && p[i] >= '0' && p[i] <= '7'; ++i, any = true)
+        v = (v << 3) | (uint64_t)(p[i] - '0');
+    return any;
+}
+
+inline std::string tar_string(const unsigned char* p, std::size_t len) {
+    return std::string((const char*)p, strnlen((const char*)p, len));
+}
+
+}  // namespace archive
+
+/*
+ * Members of a zip file from its central directory alone: the end record is found in the last
+ * 64 KiB and the directory it points to is walked in place, ZIP64 included. Local headers and
+ * data are never touched. f(const ArchiveEntry&) per member; false when this is not a readable zip.
+ */
+template <typename F>
+bool list_zip(const std::filesystem::path& p, F&& f) {
+    using namespace archive;
+    MappedFile m;
+    if(!m.open(p) || m.size() < 22)
+        return false;
+    const unsigned char* d = m.data();
+    std::size_t n = m.size();
+
+    std::size_t eocd = n - 22, stop = n - 22 > 65535 ? n - 22 - 65535 : 0;
+    while(le32(d + eocd) != 0x06054b50) {
+        if(eocd == stop)
+            return false;
+        --eocd;
+    }
+    uint64_t count = le16(d + eocd + 10), cd_size = le32(d + eocd + 12), cd_off = le32(d + eocd + 16);
+    if(eocd >= 20 && le32(d + eocd - 20) == 0x07064b50) {
+        uint64_t z64 = le64(d + eocd - 20 + 8);
+        if(n >= 56 && z64 <= n - 56 && le32(d + z64) == 0x06064b50) {
+            count = le64(d + z64 + 32);
+            cd_size = le64(d + z64 + 40);
+            cd_off = le64(d + z64 + 48);
+        }
+    }
+    if(cd_off > n || cd_size > n - cd_off)
+        return false;
+
+    ArchiveEntry e;
+    const unsigned char* c = d + cd_off;
+    const unsigned char* end = c + cd_size;
+    for(uint64_t i = 0; i < count && end - c >= 46 && le32(c) == 0x02014b50; ++i) {
+        uint16_t flags = le16(c + 8), nlen = le16(c + 28), xlen = le16(c + 30), clen = le16(c + 32);
+        if((std::size_t)(end - c) < 46u + nlen + xlen + clen)
+            break;
+        e.name.assign((const char*)c + 46, nlen);
+        e.utf8 = (flags & 0x800) != 0;
+        e.is_dir = nlen > 0 && (c[46 + nlen - 1] == '/' || c[46 + nlen - 1] == '\\');
+        e.size = le32(c + 24);
+        e.mtime = dos_time(le16(c + 14), le16(c + 12));
+
+        /* ZIP64 sizes and the Unix timestamp live in the extra field */
+        const unsigned char* x = c + 46 + nlen;
+        for(const unsigned char* xe = x + xlen; xe - x >= 4;) {
+            uint16_t id = le16(x), len = le16(x + 2);
+            if(xe - x - 4 < len)
+                break;
+            if(id == 0x0001 && le32(c + 24) == 0xffffffff && len >= 8)
+                e.size = le64(x + 4);
+            else if(id == 0x5455 && len >= 5 && (x[4] & 1))
+                e.mtime = (int64_t)le32(x + 5);
+            x += 4 + len;
+        }
+        f(e);
+        c += 46 + nlen + xlen + clen;
+    }
+    return true;
+}
+
+/*
+ * Members of an uncompressed tar file, one 512 byte header at a time, seeking past the data.
+ * POSIX ustar prefixes, GNU long names and pax path/size/mtime records are honoured.
+ * f(const ArchiveEntry&) per member; false when the file does not start with a valid header.
+ */
+template <typename F>
+bool list_tar(const std::filesystem::path& p, F&& f) {
+    using namespace archive;
+#ifdef _WIN32
+    HANDLE h = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(h == INVALID_HANDLE_VALUE)
+        return false;
+    auto read_at = [&](uint64_t off, void* dst, std::size_t len) {
+        OVERLAPPED ov = {0};
+        ov.Offset = (DWORD)off;
+        ov.OffsetHigh = (DWORD)(off >> 32);
+        DWORD got = 0;
+        return ReadFile(h, dst, (DWORD)len, &got, &ov) && got == len;
+    };
+#else
+    int fd = open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    auto read_at = [&](uint64_t off, void* dst, std::size_t len) { return pread(fd, dst, len, (off_t)off) == (ssize_t)len; };
+#endif
+    /* long names and pax records are read whole, up to this size */
+    static const uint64_t META_MAX = 64 * 1024;
+
+    unsigned char b[512];
+    uint64_t off = 0;
+    bool any = false;
+    std::string long_name, pax_path;
+    uint64_t pax_size = 0;
+    int64_t pax_mtime = 0;
+    bool has_pax_size = false, has_pax_mtime = false;
+    ArchiveEntry e;
+    while(read_at(off, b, sizeof(b))) {
+        uint64_t sum = 0, want;
+        for(std::size_t i = 0; i < sizeof(b); ++i)
+            sum += (i >= 148 && i < 156) ? ' ' : b[i];
+        if(sum == 8 * ' ')
+            break; /* a zero block ends the archive */
+        if(!tar_number(b + 148, 8, want) || want != sum)
+            break;
+        any = true;
+
+        uint64_t size = 0, mtime = 0;
+        tar_number(b + 124, 12, size);
+        tar_number(b + 136, 12, mtime);
+        char type = (char)b[156];
+        uint64_t data = off + 512;
+        off = data + ((size + 511) & ~(uint64_t)511);
+        if(off < data)
+            break; /* a size that wraps around is garbage, not a seek backwards */
+
+        if(type == 'L' || type == 'x') {
+            std::string meta(size <= META_MAX ? (std::size_t)size : 0, '\0');
+            if(meta.empty() || !read_at(data, &meta[0], meta.size()))
+                continue;
+            if(type == 'L') {
+                long_name.assign(meta.c_str());
+                continue;
+            }
+            /* pax: "<len> <key>=<value>\n" records */
+            for(std::size_t i = 0; i < meta.size();) {
+                std::size_t len = strtoul(meta.c_str() + i, NULL, 10), sp = meta.find(' ', i);
+                if(len == 0 || i + len > meta.size() || sp == std::string::npos || sp >= i + len)
+                    break;
+                std::size_t eq = meta.find('=', sp);
+                if(eq + 1 < i + len) {
+                    std::string key = meta.substr(sp + 1, eq - sp - 1), val = meta.substr(eq + 1, i + len - eq - 2);
+                    if(key == "path") {
+                        pax_path = val;
+                    } else if(key == "size") {
+                        pax_size = strtoull(val.c_str(), NULL, 10);
+                        has_pax_size = true;
+                    } else if(key == "mtime") {
+                        pax_mtime = (int64_t)strtoll(val.c_str(), NULL, 10);
+                        has_pax_mtime = true;
+                    }
+                }
+                i += len;
+            }
+            continue;
+        }
+        if(type == 'g' || type == 'K' || type == 'V')
+            continue;
+
+        e.utf8 = !pax_path.empty(); /* pax records are UTF-8, header names are not */
+        if(!pax_path.empty()) {
+            e.name = pax_path;
+        } else if(!long_name.empty()) {
+            e.name = long_name;
+        } else {
+            e.name = tar_string(b, 100);
+            /* only POSIX ustar has the prefix; old GNU headers ("ustar  \0") keep atime and ctime there */
+            if(memcmp(b + 257, "ustar\0" "00", 8) == 0 && b[345])
+                e.name = tar_string(b + 345, 155) + "/" + e.name;
+        }
+        if(has_pax_size) {
+            size = pax_size;
+            off = data + ((size + 511) & ~(uint64_t)511);
+            if(off < data)
+                break;
+        }
+        e.is_dir = type == '5' || (!e.name.empty() && e.name.back() == '/');
+        e.size = (type == '0' || type == '\0' || type == '7') ? size : 0;
+        e.mtime = has_pax_mtime ? pax_mtime : (int64_t)mtime;
+        f(e);
+        long_name.clear();
+        pax_path.clear();
+        has_pax_size = has_pax_mtime = false;
+    }
+#ifdef _WIN32
+    CloseHandle(h);
+#else
+    close(fd);
+#endif
+    return any;
+}
+
+/* .zip or .tar, by extension. other archives, compressed tars included, are not looked into */
+inline bool is_archive(const std::filesystem::path& p) {
+    const auto& s = p.native();
+    if(s.size() < 4 || s[s.size() - 4] != '.')
+        return false;
+    char a = (char)(s[s.size() - 3] | 32), b = (char)(s[s.size() - 2] | 32), c = (char)(s[s.size() - 1] | 32);
+    return (a == 'z' && b == 'i' && c == 'p') || (a == 't' && b == 'a' && c == 'r');
+}
+
+template <typename F>
+bool list_archive(const std::filesystem::path& p, F&& f) {
+    const auto& s = p.native();
+    return (s[s.size() - 3] | 32) == 'z' ? list_zip(p, f) : list_tar(p, f);
+}
+
+#endif /* _ARCHIVE_HPP_ */
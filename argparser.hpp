@@ -140,13 +140,13 @@ struct argstruct {
 
     bool operator==(const CharT* arg) { 
         if(arg && *arg && arg[0] == '-') {
-            if (arg[1] == shortarg[1] && arg[2] == 0){
+            if (shortarg && arg[1] == shortarg[1] && arg[2] == 0){
                 length_of_match = 2;
                 return true;
             }
             const CharT* lng = longarg;
-            while(*arg && *lng && *arg++ == *lng++) {}
-            if(*lng == 0) {
+            while(*arg && *arg == *lng) { ++arg; ++lng; }
+            if(*arg == 0 && *lng == 0) {
                 length_of_match = lng - longarg;
                 return true;
             }
@@ -254,7 +254,7 @@ struct argparser {
         for(auto& as : args) {
             bool req = as.item == ITEM::REQUIRED;
             printany(req ? " " : " [", as.shortarg);
-            if(as.longarg[0])
+            if(as.shortarg && as.longarg[0])
                 printany(',');
             printany(as.longarg, req ? " " : "] ");
             std::size_t len = Traits::length(as.longarg);
@@ -269,7 +269,9 @@ struct argparser {
         printany("Arguments:\n", "    -h, --help\n\n");
         for(auto& as : args) {
             printany("    ", as.shortarg);
-            if(as.longarg[0])
+            if(as.shortarg == NULL)
+                printany("    ", as.longarg);
+            else if(as.longarg[0])
                 printany(", ", as.longarg);
             std::cout << std::left << std::setw(max_len + rightpad - Traits::length(as.longarg)) << "";
             printany(as.type_string(), as.helpstr, "\n");
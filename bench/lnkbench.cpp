@@ -0,0 +1,91 @@
+/* lnkbench.cpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+/*
+ * Shortcut throughput: LnkView parsing and LnkRewriter on links built in memory, and on Windows
+ * liblnk's own builder and reader (createLinkTargetIDList, getLinkInfo) with MemoryBuffers on the
+ * heap and in a per-round LnkArena.
+ *
+ *   lnkbench [seconds per case]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+#include "liblnk.hpp"
+#include "lnkbuild.hpp"
+
+static double seconds = 1.0;
+
+/* runs f in batches until the time is up and prints calls per second */
+static void measure(const char* name, const std::function<bool()>& f) {
+    typedef std::chrono::steady_clock clock;
+    long long calls = 0;
+    bool ok = true;
+    auto start = clock::now();
+    double elapsed = 0;
+    do {
+        for(int i = 0; i < 256; ++i)
+            ok = f() && ok;
+        calls += 256;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < seconds);
+    printf("%-36s %12.0f /s%s\n", name, calls / elapsed, ok ? "" : "  (failed)");
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1)
+        seconds = atof(argv[1]);
+
+    Spec local;
+    local.info_unicode = true;
+    local.environment = true;
+    Spec network;
+    network.network = true;
+    Bytes a = build(local), b = build(network);
+
+    LnkView view;
+    measure("LnkView::parse local", [&] { return view.parse(a.data(), a.size()); });
+    measure("LnkView::parse network", [&] { return view.parse(b.data(), b.size()); });
+
+    LnkRewriter rewriter("C:\\dir", "D:\\data\\moved", u"C:\\dir", u"D:\\data\\moved");
+    std::vector<unsigned char> out;
+    bool changed;
+    measure("LnkRewriter::rewrite", [&] { return rewriter.rewrite(a.data(), a.size(), out, changed) && changed; });
+
+#ifdef _WIN32
+    char self[MAX_PATH];
+    GetModuleFileNameA(NULL, self, MAX_PATH);
+    char folder[MAX_PATH];
+    GetTempPathA(MAX_PATH, folder);
+    std::string path = std::string(folder) + "lnkbench.lnk";
+    LinkInfo info;
+    info.target = self;
+    info.description = "lnkbench";
+    info.workingDirectory = folder;
+    if(!createLink(path.c_str(), info)) {
+        fprintf(stderr, "could not create %s\n", path.c_str());
+        return 1;
+    }
+
+    measure("createLinkTargetIDList heap", [&] { return createLinkTargetIDList(path.c_str(), info).getSize() > 0; });
+    measure("getLinkInfo heap", [&] {
+        LinkInfo got;
+        return getLinkInfo(path.c_str(), got);
+    });
+    LnkArena arena;
+    measure("createLinkTargetIDList arena", [&] {
+        arena.reset();
+        LnkArena::Scope scope(arena);
+        return createLinkTargetIDList(path.c_str(), info).getSize() > 0;
+    });
+    measure("getLinkInfo arena", [&] {
+        arena.reset();
+        LnkArena::Scope scope(arena);
+        LinkInfo got;
+        return getLinkInfo(path.c_str(), got);
+    });
+    remove(path.c_str());
+#endif
+    return 0;
+}
@@ -0,0 +1,212 @@
+/* dirstate.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _DIRSTATE_HPP_
+#define _DIRSTATE_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "dirwalk.hpp"
+#include "openhash.hpp"
+#include "records.hpp"
+
+/*
+ * Per directory listing cache for incremental rescans (--state).
+ * A directory whose mtime and ctime still match the stored ones, and that was read within
+ * verify_interval seconds, is not read again: its cached entries are replayed instead.
+ * Entry stats are replayed as stored, so a file changed in place without touching its
+ * directory shows up only once the directory is re-read. verify_interval bounds that.
+ * Times are whole seconds, so a directory whose times are within a second of the run's start
+ * could change again without its times moving: it is stored as untrusted and read next time too.
+ */
+class DirStateCache {
+   public:
+    using PathString = fs::path::string_type;
+
+    struct Entry {
+        PathString name;
+        StatInfo st;
+    };
+    struct DirState {
+        int64_t mtime = 0;
+        int64_t ctime = 0;
+        int64_t verified = 0;
+        std::vector<Entry> entries;
+        bool seen = false;
+    };
+
+    /* 0 means directories are trusted until their times change */
+    int64_t verify_interval = 0;
+
+    DirStateCache() : now((int64_t)time(NULL)), reused(0), reread(0) {}
+
+    std::size_t reused_dirs() const { return reused; }
+    std::size_t reread_dirs() const { return reread; }
+
+    /*
+     * a missing file, or one written by another version of the format, is an empty cache.
+     * false only for a file that exists but is not a state file
+     */
+    bool load(const fs::path& p) {
+        std::error_code ec;
+        if(!fs::exists(p, ec))
+            return true;
+        FILE* fp = open_binary(p, false);
+        if(fp == NULL)
+            return false;
+        char magic[sizeof(MAGIC)];
+        bool ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(magic) - 1) == 0;
+        if(ok && magic[sizeof(magic) - 1] != MAGIC[sizeof(MAGIC) - 1]) {
+            fclose(fp);
+            return true;
+        }
+        PathString dir;
+        while(ok && read_string(fp, dir)) {
+            DirState& ds = dirs[dir];
+            uint32_t n = 0;
+            ok = fread(&ds.mtime, sizeof(ds.mtime), 1, fp) == 1 && fread(&ds.ctime, sizeof(ds.ctime), 1, fp) == 1 &&
+                 fread(&ds.verified, sizeof(ds.verified), 1, fp) == 1 && fread(&n, sizeof(n), 1, fp) == 1;
+            ds.entries.resize(ok ? n : 0);
+            for(uint32_t i = 0; ok && i < n; ++i)
+                ok = read_string(fp, ds.entries[i].name) && read_stat(fp, ds.entries[i].st);
+        }
+        fclose(fp);
+        return ok;
+    }
+
+    /* writes the directories seen or re-read by this run. dropped directories fall out of the state */
+    bool save(const fs::path& p) {
+        fs::path tmp = p.native() + fs::path(L".tmp").native();
+        FILE* fp = open_binary(tmp, true);
+        if(fp == NULL)
+            return false;
+        bool ok = fwrite(MAGIC, 1, sizeof(MAGIC), fp) == sizeof(MAGIC);
+        dirs.for_each([&](const PathString& dir, DirState& ds) {
+            if(ok && ds.seen)
+                ok = write_dir(fp, dir, ds);
+        });
+        for(auto& f : fresh) {
+            if(ok)
+                ok = write_dir(fp, f.first, f.second);
+        }
+        ok = fclose(fp) == 0 && ok;
+        std::error_code ec;
+        if(ok)
+            fs::rename(tmp, p, ec);
+        if(!ok || ec) {
+            fs::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    /* DirWalker::reader: replays dir from the cache when it is still valid, otherwise reads and records it */
+    bool read(const fs::path& dir, bool identity, const std::function<void(const fs::path&, const StatInfo&)>& f) {
+        StatInfo self;
+        if(!stat_path(dir, self))
+            return false;
+        DirState* cached = dirs.find(dir.native());
+        if(cached && cached->mtime == self.mtime && cached->ctime == self.ctime &&
+           (verify_interval == 0 || now - cached->verified < verify_interval)) {
+            cached->seen = true;
+            for(auto& e : cached->entries)
+                f(dir / e.name, e.st);
+            std::lock_guard<std::mutex> lk(mtx);
+            ++reused;
+            return true;
+        }
+
+        DirState ds;
+        ds.mtime = self.mtime;
+        ds.ctime = self.ctime;
+        ds.verified = now;
+        if(now - self.mtime <= 1 || now - self.ctime <= 1)
+            ds.mtime = ds.ctime = UNTRUSTED; /* racy: a change in the same second would not move the times */
+        bool ok = read_dir(dir, identity, [&](const fs::path& p, const StatInfo& st) {
+            ds.entries.push_back({p.filename().native(), st});
+            f(p, st);
+        });
+        if(ok) {
+            std::lock_guard<std::mutex> lk(mtx);
+            fresh.emplace_back(dir.native(), std::move(ds));
+            ++reread;
+        }
+        return ok;
+    }
+
+   private:
+    /* 2: StatInfo written field by field instead of as raw struct bytes */
+    static constexpr char MAGIC[8] = {'L', 'S', 'D', 'S', 'T', 'A', 'T', '2'};
+    static const int64_t UNTRUSTED = INT64_MIN;
+
+    /* the fields of StatInfo in a fixed order and width, whatever the struct's layout */
+    static bool write_stat(FILE* fp, const StatInfo& st) {
+        uint64_t u[5] = {st.dev, st.ino, st.nlink, st.size, st.blocks};
+        int64_t t[3] = {st.atime, st.mtime, st.ctime};
+        uint32_t m[3] = {st.uid, st.gid, st.mode};
+        uint8_t flags = (uint8_t)((st.is_dir ? 1 : 0) | (st.is_link ? 2 : 0));
+        return fwrite(u, sizeof(u), 1, fp) == 1 && fwrite(t, sizeof(t), 1, fp) == 1 && fwrite(m, sizeof(m), 1, fp) == 1 &&
+               fwrite(&flags, 1, 1, fp) == 1;
+    }
+    static bool read_stat(FILE* fp, StatInfo& st) {
+        uint64_t u[5];
+        int64_t t[3];
+        uint32_t m[3];
+        uint8_t flags;
+        if(fread(u, sizeof(u), 1, fp) != 1 || fread(t, sizeof(t), 1, fp) != 1 || fread(m, sizeof(m), 1, fp) != 1 ||
+           fread(&flags, 1, 1, fp) != 1)
+            return false;
+        st.dev = u[0];
+        st.ino = u[1];
+        st.nlink = u[2];
+        st.size = u[3];
+        st.blocks = u[4];
+        st.atime = t[0];
+        st.mtime = t[1];
+        st.ctime = t[2];
+        st.uid = m[0];
+        st.gid = m[1];
+        st.mode = m[2];
+        st.is_dir = (flags & 1) != 0;
+        st.is_link = (flags & 2) != 0;
+        return true;
+    }
+
+    static bool read_string(FILE* fp, PathString& s) {
+        uint32_t len = 0;
+        if(fread(&len, sizeof(len), 1, fp) != 1)
+            return false;
+        s.resize(len);
+        return fread(&s[0], sizeof(s[0]), len, fp) == len;
+    }
+    static bool write_string(FILE* fp, const PathString& s) {
+        uint32_t len = (uint32_t)s.size();
+        return fwrite(&len, sizeof(len), 1, fp) == 1 && fwrite(s.data(), sizeof(s[0]), len, fp) == len;
+    }
+    static bool write_dir(FILE* fp, const PathString& dir, const DirState& ds) {
+        uint32_t n = (uint32_t)ds.entries.size();
+        bool ok = write_string(fp, dir) && fwrite(&ds.mtime, sizeof(ds.mtime), 1, fp) == 1 &&
+                  fwrite(&ds.ctime, sizeof(ds.ctime), 1, fp) == 1 &&
+                  fwrite(&ds.verified, sizeof(ds.verified), 1, fp) == 1 && fwrite(&n, sizeof(n), 1, fp) == 1;
+        for(auto& e : ds.entries) {
+            if(ok)
+                ok = write_string(fp, e.name) && write_stat(fp, e.st);
+        }
+        return ok;
+    }
+
+    int64_t now;
+    OpenHashMap<PathString, DirState> dirs;
+    std::vector<std::pair<PathString, DirState>> fresh;
+    std::mutex mtx;
+    std::size_t reused;
+    std::size_t reread;
+};
+
+#endif /* _DIRSTATE_HPP_ */
@@ -0,0 +1,512 @@
+/* dirwalk.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _DIRWALK_HPP_
+#define _DIRWALK_HPP_
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/* stat fields shared by every walker consumer. blocks is the allocated size in bytes */
+struct StatInfo {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+    uint64_t nlink = 1;
+    uint64_t size = 0;
+    uint64_t blocks = 0;
+    int64_t atime = 0;
+    int64_t mtime = 0;
+    int64_t ctime = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t mode = 0;
+    bool is_dir = false;
+    bool is_link = false;
+};
+
+#ifdef _WIN32
+inline int64_t filetime_to_unix(const FILETIME& ft) {
+    uint64_t t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (int64_t)(t / 10000000ULL) - 11644473600LL;
+}
+
+/* st_mode as _wstat reports it: type bits plus read/write permission from the read-only attribute */
+inline uint32_t mode_from_attributes(DWORD attr) {
+    uint32_t m = (attr & FILE_ATTRIBUTE_DIRECTORY) ? 0040555 : 0100444;
+    return (attr & FILE_ATTRIBUTE_READONLY) ? m : m | 0222;
+}
+
+inline void stat_from_find_data(const WIN32_FIND_DATAW& fd, StatInfo& st) {
+    st.size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+    st.blocks = st.size;
+    st.atime = filetime_to_unix(fd.ftLastAccessTime);
+    st.mtime = filetime_to_unix(fd.ftLastWriteTime);
+    st.ctime = filetime_to_unix(fd.ftCreationTime);
+    st.mode = mode_from_attributes(fd.dwFileAttributes);
+    st.is_dir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    st.is_link = (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && fd.dwReserved0 == IO_REPARSE_TAG_SYMLINK;
+}
+
+/* volume serial, file index, link count and allocation size need an open handle on Windows */
+inline bool stat_identity(const fs::path& p, StatInfo& st) {
+    HANDLE h = CreateFileW(p.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                           OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, NULL);
+    if(h == INVALID_HANDLE_VALUE)
+        return false;
+    BY_HANDLE_FILE_INFORMATION bhfi;
+    if(GetFileInformationByHandle(h, &bhfi)) {
+        st.dev = bhfi.dwVolumeSerialNumber;
+        st.ino = ((uint64_t)bhfi.nFileIndexHigh << 32) | bhfi.nFileIndexLow;
+        st.nlink = bhfi.nNumberOfLinks;
+    }
+    FILE_STANDARD_INFO si;
+    if(GetFileInformationByHandleEx(h, FileStandardInfo, &si, sizeof(si)))
+        st.blocks = (uint64_t)si.AllocationSize.QuadPart;
+    CloseHandle(h);
+    return true;
+}
+#else
+inline void stat_from_stat(const struct stat& s, StatInfo& st) {
+    st.dev = (uint64_t)s.st_dev;
+    st.ino = (uint64_t)s.st_ino;
+    st.nlink = (uint64_t)s.st_nlink;
+    st.size = (uint64_t)s.st_size;
+    st.blocks = (uint64_t)s.st_blocks * 512;
+    st.atime = (int64_t)s.st_atime;
+    st.mtime = (int64_t)s.st_mtime;
+    st.ctime = (int64_t)s.st_ctime;
+    st.uid = (uint32_t)s.st_uid;
+    st.gid = (uint32_t)s.st_gid;
+    st.mode = (uint32_t)s.st_mode;
+    st.is_dir = S_ISDIR(s.st_mode);
+    st.is_link = S_ISLNK(s.st_mode);
+}
+#endif
+
+/* lstat equivalent. identity also fills dev/ino/nlink/blocks on Windows */
+inline bool stat_path(const fs::path& p, StatInfo& st, bool identity = false) {
+#ifdef _WIN32
+    WIN32_FIND_DATAW fd;
+    HANDLE h = FindFirstFileExW(p.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, 0);
+    if(h == INVALID_HANDLE_VALUE) {
+        WIN32_FILE_ATTRIBUTE_DATA ad;
+        if(!GetFileAttributesExW(p.c_str(), GetFileExInfoStandard, &ad))
+            return false;
+        st.size = ((uint64_t)ad.nFileSizeHigh << 32) | ad.nFileSizeLow;
+        st.blocks = st.size;
+        st.atime = filetime_to_unix(ad.ftLastAccessTime);
+        st.mtime = filetime_to_unix(ad.ftLastWriteTime);
+        st.ctime = filetime_to_unix(ad.ftCreationTime);
+        st.mode = mode_from_attributes(ad.dwFileAttributes);
+        st.is_dir = (ad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    } else {
+        stat_from_find_data(fd, st);
+        FindClose(h);
+    }
+    if(identity)
+        stat_identity(p, st);
+    return true;
+#else
+    (void)identity;
+    struct stat s;
+    if(lstat(p.c_str(), &s) != 0)
+        return false;
+    stat_from_stat(s, st);
+    return true;
+#endif
+}
+
+/* Calls f(path, StatInfo) for every entry of dir without following symlinks. returns false if dir can't be opened */
+template <typename F>
+bool read_dir(const fs::path& dir, bool identity, F&& f) {
+#ifdef _WIN32
+    WIN32_FIND_DATAW fd;
+    HANDLE h = FindFirstFileExW((dir / L"*").c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL,
+                                FIND_FIRST_EX_LARGE_FETCH);
+    if(h == INVALID_HANDLE_VALUE)
+        return false;
+    do {
+        const wchar_t* n = fd.cFileName;
+        if(n[0] == L'.' && (n[1] == 0 || (n[1] == L'.' && n[2] == 0)))
+            continue;
+        StatInfo st;
+        stat_from_find_data(fd, st);
+        fs::path p = dir / n;
+        if(identity && !st.is_dir)
+            stat_identity(p, st);
+        f(p, st);
+    } while(FindNextFileW(h, &fd));
+    FindClose(h);
+    return true;
+#else
+    (void)identity;
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    DIR* d = fdopendir(fd);
+    if(d == NULL) {
+        close(fd);
+        return false;
+    }
+    while(struct dirent* e = readdir(d)) {
+        const char* n = e->d_name;
+        if(n[0] == '.' && (n[1] == 0 || (n[1] == '.' && n[2] == 0)))
+            continue;
+        struct stat s;
+        if(fstatat(fd, n, &s, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+        StatInfo st;
+        stat_from_stat(s, st);
+        f(dir / n, st);
+    }
+    closedir(d);
+    return true;
+#endif
+}
+
+/* Calls f(name) for every entry of dir. nothing is stat'ed. returns false if dir can't be opened */
+template <typename F>
+bool list_names(const fs::path& dir, F&& f) {
+#ifdef _WIN32
+    WIN32_FIND_DATAW fd;
+    HANDLE h = FindFirstFileExW((dir / L"*").c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL,
+                                FIND_FIRST_EX_LARGE_FETCH);
+    if(h == INVALID_HANDLE_VALUE)
+        return false;
+    do {
+        const wchar_t* n = fd.cFileName;
+        if(n[0] == L'.' && (n[1] == 0 || (n[1] == L'.' && n[2] == 0)))
+            continue;
+        f(n);
+    } while(FindNextFileW(h, &fd));
+    FindClose(h);
+    return true;
+#else
+    DIR* d = opendir(dir.c_str());
+    if(d == NULL)
+        return false;
+    while(struct dirent* e = readdir(d)) {
+        const char* n = e->d_name;
+        if(n[0] == '.' && (n[1] == 0 || (n[1] == '.' && n[2] == 0)))
+            continue;
+        f(n);
+    }
+    closedir(d);
+    return true;
+#endif
+}
+
+/* Thread pool whose tasks may submit further tasks. wait() returns once every task has finished */
+class TaskPool {
+   public:
+    using Task = std::function<void(unsigned)>;
+
+    explicit TaskPool(unsigned threads = 0, bool lifo = false) : lifo(lifo), stopping(false), active(0) {
+        if(threads == 0)
+            threads = std::thread::hardware_concurrency();
+        if(threads == 0)
+            threads = 1;
+        for(unsigned i = 0; i < threads; ++i)
+            workers.emplace_back([this, i] { loop(i); });
+    }
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for(auto& w : workers)
+            w.join();
+    }
+
+    unsigned size() const { return (unsigned)workers.size(); }
+
+    void submit(Task t) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            queue.push_back(std::move(t));
+            ++active;
+        }
+        cv.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lk(mtx);
+        idle.wait(lk, [this] { return active == 0; });
+    }
+
+   private:
+    void loop(unsigned tid) {
+        for(;;) {
+            Task t;
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                cv.wait(lk, [this] { return stopping || !queue.empty(); });
+                if(queue.empty())
+                    return;
+                if(lifo) {
+                    t = std::move(queue.back());
+                    queue.pop_back();
+                } else {
+                    t = std::move(queue.front());
+                    queue.pop_front();
+                }
+            }
+            t(tid);
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                if(--active == 0)
+                    idle.notify_all();
+            }
+        }
+    }
+
+    bool lifo;
+    bool stopping;
+    std::size_t active;
+    std::deque<Task> queue;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable idle;
+    std::vector<std::thread> workers;
+};
+
+/*
+ * Runs work(tid, Row&) on a TaskPool and hands the rows to emit(Row&) in push order.
+ * At most `window` rows are in flight: push() emits finished rows from the front and
+ * blocks when the oldest one is still running. push(), flush(), finish() and emit run
+ * on the producer thread only.
+ * Rows needing work are submitted in batches of up to `batch` rows, one task per batch;
+ * flush() submits a partial batch early, e.g. when the rows of one directory end.
+ */
+template <typename Row>
+class OrderedPipeline {
+   public:
+    using Work = std::function<void(unsigned, Row&)>;
+    using Emit = std::function<void(Row&)>;
+
+    OrderedPipeline(unsigned threads, std::size_t window, Work work, Emit emit, std::size_t batch = 1)
+        : pool(threads),
+          window(window ? window : 1),
+          batch_size(batch ? batch : 1),
+          work(std::move(work)),
+          emit(std::move(emit)) {}
+    OrderedPipeline(const OrderedPipeline&) = delete;
+    OrderedPipeline& operator=(const OrderedPipeline&) = delete;
+    ~OrderedPipeline() { pool.wait(); }
+
+    unsigned threads() const { return pool.size(); }
+
+    /* a row pushed with needs_work false only waits for its turn to be emitted */
+    void push(Row row, bool needs_work = true) {
+        drain(window - 1);
+        Slot* s;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            slots.emplace_back();
+            s = &slots.back();
+            s->row = std::move(row);
+            s->done = !needs_work;
+        }
+        if(needs_work) {
+            batch.push_back(s);
+            if(batch.size() >= batch_size)
+                flush();
+        }
+        drain(SIZE_MAX);
+    }
+
+    void flush() {
+        if(batch.empty())
+            return;
+        pool.submit([this, rows = std::move(batch)](unsigned tid) {
+            for(Slot* s : rows) {
+                work(tid, s->row);
+                {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    s->done = true;
+                }
+                ready.notify_one();
+            }
+        });
+        batch.clear();
+    }
+
+    /* emits every remaining row */
+    void finish() {
+        flush();
+        drain(0);
+    }
+
+   private:
+    struct Slot {
+        Row row;
+        bool done = false;
+    };
+
+    /* emits finished rows from the front, waiting while more than `keep` rows are pending */
+    void drain(std::size_t keep) {
+        std::unique_lock<std::mutex> lk(mtx);
+        while(!slots.empty()) {
+            if(!slots.front().done) {
+                if(slots.size() <= keep)
+                    return;
+                if(!batch.empty()) {
+                    /* the row waited for may still sit in the unsubmitted batch */
+                    lk.unlock();
+                    flush();
+                    lk.lock();
+                }
+                ready.wait(lk, [this] { return slots.front().done; });
+            }
+            Slot& s = slots.front();
+            lk.unlock();
+            emit(s.row);
+            lk.lock();
+            slots.pop_front();
+        }
+    }
+
+    TaskPool pool;
+    std::size_t window;
+    std::size_t batch_size;
+    Work work;
+    Emit emit;
+    std::deque<Slot> slots;
+    std::vector<Slot*> batch;
+    std::mutex mtx;
+    std::condition_variable ready;
+};
+
+/* (dev, ino) set shared between walker threads, used to count hard links once */
+class InodeSet {
+   public:
+    /* returns true the first time (dev, ino) is seen */
+    bool insert(uint64_t dev, uint64_t ino) {
+        Shard& s = shards[(ino ^ (dev << 7)) % SHARDS];
+        std::lock_guard<std::mutex> lk(s.mtx);
+        return s.ids.insert({dev, ino}).second;
+    }
+
+   private:
+    struct IdHash {
+        std::size_t operator()(const std::pair<uint64_t, uint64_t>& k) const {
+            return std::hash<uint64_t>()(k.second * 0x9E3779B97F4A7C15ULL ^ k.first);
+        }
+    };
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_set<std::pair<uint64_t, uint64_t>, IdHash> ids;
+    };
+    static const unsigned SHARDS = 64;
+    Shard shards[SHARDS];
+};
+
+struct NoPayload {};
+
+struct WalkEntry {
+    fs::path path;
+    StatInfo st;
+    int depth;
+};
+
+/*
+ * Parallel directory walker. Each directory is listed by one pool thread; its subdirectories are queued as new tasks.
+ * on_entry(tid, entry, parent) is called for every entry and returns whether a directory should be descended.
+ * on_dir_done(tid, node) is called once the whole subtree below node has been walked, children before parents,
+ * so Payload can be used to accumulate results bottom-up. Depth follows recursive_directory_iterator (root entries = 0).
+ * Node::unreadable tells on_dir_done that the directory itself could not be listed.
+ * reader, when set, replaces read_dir for listing a directory, e.g. to serve entries from a cache.
+ */
+template <typename Payload = NoPayload>
+class DirWalker {
+   public:
+    struct Node {
+        fs::path path;
+        int depth;
+        Node* parent;
+        std::atomic<long> pending;
+        bool unreadable;
+        Payload data;
+        Node(const fs::path& p, int d, Node* pa) : path(p), depth(d), parent(pa), pending(1), unreadable(false), data() {}
+    };
+
+    std::function<bool(unsigned, const WalkEntry&, Node&)> on_entry;
+    std::function<void(unsigned, Node&)> on_dir_done;
+    using EntryFn = std::function<void(const fs::path&, const StatInfo&)>;
+    std::function<bool(unsigned, Node&, const EntryFn&)> reader;
+    int maxdepth = INT_MAX;
+    bool identity = false;
+
+    explicit DirWalker(unsigned threads = 0) : pool(threads, true) {}
+
+    unsigned threads() const { return pool.size(); }
+
+    void add(const fs::path& root) {
+        Node* node = new Node(root, -1, NULL);
+        pool.submit([this, node](unsigned tid) { list(tid, node); });
+    }
+
+    void wait() { pool.wait(); }
+
+   private:
+    void list(unsigned tid, Node* node) {
+        WalkEntry e;
+        e.depth = node->depth + 1;
+        if(e.depth <= maxdepth) {
+            auto visit = [&](const fs::path& p, const StatInfo& st) {
+                e.path = p;
+                e.st = st;
+                bool descend = on_entry ? on_entry(tid, e, *node) : true;
+                if(descend && st.is_dir && !st.is_link && e.depth < maxdepth) {
+                    node->pending.fetch_add(1, std::memory_order_relaxed);
+                    Node* child = new Node(p, e.depth, node);
+                    pool.submit([this, child](unsigned t) { list(t, child); });
+                }
+            };
+            if(reader)
+                node->unreadable = !reader(tid, *node, EntryFn(visit));
+            else
+                node->unreadable = !read_dir(node->path, identity, visit);
+        }
+        finish(tid, node);
+    }
+
+    void finish(unsigned tid, Node* node) {
+        while(node && node->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if(on_dir_done)
+                on_dir_done(tid, *node);
+            Node* parent = node->parent;
+            delete node;
+            node = parent;
+        }
+    }
+
+    TaskPool pool;
+};
+
+#endif /* _DIRWALK_HPP_ */
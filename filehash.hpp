@@ -0,0 +1,351 @@
+/* filehash.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _FILEHASH_HPP_
+#define _FILEHASH_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* MurmurHash3 x64 128bit (public domain, Austin Appleby), fed incrementally */
+class Murmur3 {
+   public:
+    static const std::size_t DIGEST_SIZE = 16;
+
+    explicit Murmur3(uint64_t seed = 0) : h1(seed), h2(seed), total(0), tail_len(0) {}
+
+    void update(const void* data, std::size_t len) {
+        const unsigned char* p = (const unsigned char*)data;
+        total += len;
+        if(tail_len) {
+            std::size_t n = (std::min)(len, (std::size_t)16 - tail_len);
+            memcpy(tail + tail_len, p, n);
+            tail_len += n;
+            p += n;
+            len -= n;
+            if(tail_len < 16)
+                return;
+            block(tail);
+            tail_len = 0;
+        }
+        for(; len >= 16; p += 16, len -= 16)
+            block(p);
+        memcpy(tail, p, len);
+        tail_len = len;
+    }
+
+    void finish(unsigned char out[DIGEST_SIZE]) {
+        uint64_t k1 = 0, k2 = 0;
+        switch(tail_len) {
+            case 15: k2 ^= (uint64_t)tail[14] << 48; /* fall through */
+            case 14: k2 ^= (uint64_t)tail[13] << 40; /* fall through */
+            case 13: k2 ^= (uint64_t)tail[12] << 32; /* fall through */
+            case 12: k2 ^= (uint64_t)tail[11] << 24; /* fall through */
+            case 11: k2 ^= (uint64_t)tail[10] << 16; /* fall through */
+            case 10: k2 ^= (uint64_t)tail[9] << 8; /* fall through */
+            case 9:
+                k2 ^= (uint64_t)tail[8];
+                k2 *= C2;
+                k2 = rotl(k2, 33);
+                k2 *= C1;
+                h2 ^= k2;
+                /* fall through */
+            case 8: k1 ^= (uint64_t)tail[7] << 56; /* fall through */
+            case 7: k1 ^= (uint64_t)tail[6] << 48; /* fall through */
+            case 6: k1 ^= (uint64_t)tail[5] << 40; /* fall through */
+            case 5: k1 ^= (uint64_t)tail[4] << 32; /* fall through */
+            case 4: k1 ^= (uint64_t)tail[3] << 24; /* fall through */
+            case 3: k1 ^= (uint64_t)tail[2] << 16; /* fall through */
+            case 2: k1 ^= (uint64_t)tail[1] << 8; /* fall through */
+            case 1:
+                k1 ^= (uint64_t)tail[0];
+                k1 *= C1;
+                k1 = rotl(k1, 31);
+                k1 *= C2;
+                h1 ^= k1;
+        }
+        h1 ^= total;
+        h2 ^= total;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+        h1 += h2;
+        h2 += h1;
+        for(int i = 0; i < 8; ++i) {
+            out[i] = (unsigned char)(h1 >> (8 * i));
+            out[8 + i] = (unsigned char)(h2 >> (8 * i));
+        }
+    }
+
+   private:
+    static const uint64_t C1 = 0x87c37b91114253d5ULL;
+    static const uint64_t C2 = 0x4cf5ad432745937fULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t load64(const unsigned char* p) {
+        uint64_t v = 0;
+        for(int i = 7; i >= 0; --i)
+            v = (v << 8) | p[i];
+        return v;
+    }
+    static uint64_t fmix(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    void block(const unsigned char* p) {
+        uint64_t k1 = load64(p), k2 = load64(p + 8);
+        k1 *= C1;
+        k1 = rotl(k1, 31);
+        k1 *= C2;
+        h1 ^= k1;
+        h1 = rotl(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+        k2 *= C2;
+        k2 = rotl(k2, 33);
+        k2 *= C1;
+        h2 ^= k2;
+        h2 = rotl(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    uint64_t h1, h2;
+    uint64_t total;
+    unsigned char tail[16];
+    std::size_t tail_len;
+};
+
+/* SHA-256 (FIPS 180-4), fed incrementally */
+class Sha256 {
+   public:
+    static const std::size_t DIGEST_SIZE = 32;
+
+    Sha256() : total(0), tail_len(0) {
+        static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(h, init, sizeof(h));
+    }
+
+    void update(const void* data, std::size_t len) {
+        const unsigned char* p = (const unsigned char*)data;
+        total += len;
+        if(tail_len) {
+            std::size_t n = (std::min)(len, (std::size_t)64 - tail_len);
+            memcpy(tail + tail_len, p, n);
+            tail_len += n;
+            p += n;
+            len -= n;
+            if(tail_len < 64)
+                return;
+            block(tail);
+            tail_len = 0;
+        }
+        for(; len >= 64; p += 64, len -= 64)
+            block(p);
+        memcpy(tail, p, len);
+        tail_len = len;
+    }
+
+    void finish(unsigned char out[DIGEST_SIZE]) {
+        uint64_t bits = total * 8;
+        unsigned char pad[72] = {0x80};
+        std::size_t n = (tail_len < 56 ? 56 : 120) - tail_len;
+        for(int i = 0; i < 8; ++i)
+            pad[n + i] = (unsigned char)(bits >> (56 - 8 * i));
+        update(pad, n + 8);
+        for(int i = 0; i < 8; ++i) {
+            out[4 * i] = (unsigned char)(h[i] >> 24);
+            out[4 * i + 1] = (unsigned char)(h[i] >> 16);
+            out[4 * i + 2] = (unsigned char)(h[i] >> 8);
+            out[4 * i + 3] = (unsigned char)h[i];
+        }
+    }
+
+   private:
+    static uint32_t rotr(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+    void block(const unsigned char* p) {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for(int i = 0; i < 16; ++i)
+            w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) | ((uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+        for(int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+        for(int i = 0; i < 64; ++i) {
+            uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+    }
+
+    uint32_t h[8];
+    uint64_t total;
+    unsigned char tail[64];
+    std::size_t tail_len;
+};
+
+/* read-only file handle with positional reads, so one file can be read from several places without seeking */
+class FileReader {
+   public:
+    static const std::size_t CHUNK = 1 << 20;
+
+    explicit FileReader(const std::filesystem::path& p) : length(0) {
+#ifdef _WIN32
+        h = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER sz;
+        if(h != INVALID_HANDLE_VALUE && GetFileSizeEx(h, &sz))
+            length = (uint64_t)sz.QuadPart;
+#else
+        fd = open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat s;
+        if(fd >= 0 && fstat(fd, &s) == 0)
+            length = (uint64_t)s.st_size;
+#endif
+    }
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+    ~FileReader() {
+#ifdef _WIN32
+        if(h != INVALID_HANDLE_VALUE)
+            CloseHandle(h);
+#else
+        if(fd >= 0)
+            close(fd);
+#endif
+    }
+
+    bool is_open() const {
+#ifdef _WIN32
+        return h != INVALID_HANDLE_VALUE;
+#else
+        return fd >= 0;
+#endif
+    }
+    uint64_t size() const { return length; }
+
+    /* reads up to len bytes at offset. returns the number of bytes read, or -1 on error */
+    long long read_at(uint64_t offset, void* buf, std::size_t len) {
+        std::size_t done = 0;
+        while(done < len) {
+#ifdef _WIN32
+            OVERLAPPED ov = {0};
+            uint64_t off = offset + done;
+            ov.Offset = (DWORD)off;
+            ov.OffsetHigh = (DWORD)(off >> 32);
+            DWORD n = 0;
+            DWORD want = (DWORD)(std::min)(len - done, (std::size_t)CHUNK * 64);
+            if(!ReadFile(h, (char*)buf + done, want, &n, &ov))
+                return GetLastError() == ERROR_HANDLE_EOF ? (long long)done : -1;
+#else
+            ssize_t n = pread(fd, (char*)buf + done, len - done, (off_t)(offset + done));
+            if(n < 0)
+                return -1;
+#endif
+            if(n == 0)
+                break;
+            done += (std::size_t)n;
+        }
+        return (long long)done;
+    }
+
+    /* feeds [offset, offset + len) to h in CHUNK sized reads. false on an error, or when the file ends
+       before offset + len (it shrank after opening), so a truncated read never passes for the whole */
+    template <typename Hasher>
+    bool hash_range(Hasher& hs, uint64_t offset, uint64_t len, std::vector<unsigned char>& buf) {
+        if(buf.size() < CHUNK)
+            buf.resize(CHUNK);
+        while(len) {
+            std::size_t want = (std::size_t)(std::min)(len, (uint64_t)CHUNK);
+            long long n = read_at(offset, buf.data(), want);
+            if(n <= 0)
+                return false;
+            hs.update(buf.data(), (std::size_t)n);
+            offset += (uint64_t)n;
+            len -= (uint64_t)n;
+        }
+        return true;
+    }
+
+   private:
+#ifdef _WIN32
+    HANDLE h;
+#else
+    int fd;
+#endif
+    uint64_t length;
+};
+
+inline std::string to_hex(const unsigned char* d, std::size_t n) {
+    static const char digits[] = "0123456789abcdef";
+    std::string s(n * 2, '0');
+    for(std::size_t i = 0; i < n; ++i) {
+        s[2 * i] = digits[d[i] >> 4];
+        s[2 * i + 1] = digits[d[i] & 15];
+    }
+    return s;
+}
+
+/* hex digest of the whole file, read in FileReader::CHUNK pieces through buf */
+template <typename Hasher>
+bool digest_file(const std::filesystem::path& p, std::vector<unsigned char>& buf, std::string& hex) {
+    FileReader f(p);
+    if(!f.is_open())
+        return false;
+    Hasher h;
+    if(!f.hash_range(h, 0, f.size(), buf))
+        return false;
+    unsigned char d[Hasher::DIGEST_SIZE];
+    h.finish(d);
+    hex = to_hex(d, sizeof(d));
+    return true;
+}
+
+#endif /* _FILEHASH_HPP_ */
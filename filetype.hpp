@@ -0,0 +1,175 @@
+/* filetype.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _FILETYPE_HPP_
+#define _FILETYPE_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include "liblnk.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * File type from the first bytes of the content, whatever the extension says.
+ * SNIFF_SIZE covers every signature below; tar keeps its magic at offset 257, so one 512 byte
+ * block is read rather than 64 bytes. That is still one read of one sector per file.
+ */
+static const std::size_t SNIFF_SIZE = 512;
+
+namespace filetype {
+
+inline bool starts(const unsigned char* d, std::size_t n, const void* magic, std::size_t len, std::size_t at = 0) {
+    return n >= at + len && memcmp(d + at, magic, len) == 0;
+}
+
+inline bool contains(const unsigned char* d, std::size_t n, const char* s) {
+    std::size_t len = strlen(s);
+    for(std::size_t i = 0; i + len <= n; ++i) {
+        if(memcmp(d + i, s, len) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* text encoding of a head that matched no signature. a multibyte sequence cut by the read counts as valid */
+inline const wchar_t* text(const unsigned char* d, std::size_t n) {
+    bool ascii = true, utf8 = true;
+    for(std::size_t i = 0; i < n; ++i) {
+        unsigned char c = d[i];
+        if(c == 0)
+            return L"BINARY";
+        if(c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1b)
+            return L"BINARY";
+        if(c < 0x80)
+            continue;
+        ascii = false;
+        if(!utf8)
+            continue;
+        std::size_t more = (c & 0xe0) == 0xc0 ? 1 : (c & 0xf0) == 0xe0 ? 2 : (c & 0xf8) == 0xf0 ? 3 : 0;
+        if(more == 0 || c == 0xc0 || c == 0xc1 || c > 0xf4) {
+            utf8 = false;
+            continue;
+        }
+        for(std::size_t k = 1; k <= more && i + k < n; ++k) {
+            if((d[i + k] & 0xc0) != 0x80) {
+                utf8 = false;
+                break;
+            }
+        }
+        if(utf8)
+            i += more;
+    }
+    return ascii ? L"ASCII" : utf8 ? L"UTF-8" : L"ANSI";
+}
+
+}  // namespace filetype
+
+/* classifies the first n bytes of a file (n <= SNIFF_SIZE is enough) */
+inline const wchar_t* sniff(const unsigned char* d, std::size_t n) {
+    using namespace filetype;
+    if(n == 0)
+        return L"EMPTY";
+    if(LnkView::isShellLink(d, n))
+        return L"LNK";
+
+    /* archives, and the formats that are archives inside */
+    if(starts(d, n, "PK\x03\x04", 4)) {
+        /* the first member's name starts at 30; Office writes [Content_Types].xml, ODF an uncompressed mimetype */
+        if(starts(d, n, "[Content_Types].xml", 19, 30))
+            return L"OOXML";
+        if(starts(d, n, "mimetypeapplication/vnd.oasis.opendocument", 42, 30))
+            return L"ODF";
+        return L"ZIP";
+    }
+    if(starts(d, n, "PK\x05\x06", 4) || starts(d, n, "PK\x07\x08", 4))
+        return L"ZIP";
+    if(starts(d, n, "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", 8))
+        return L"OLE2"; /* .doc .xls .ppt .msg .msi */
+    if(starts(d, n, "7z\xbc\xaf\x27\x1c", 6))
+        return L"7Z";
+    if(starts(d, n, "Rar!\x1a\x07", 6))
+        return L"RAR";
+    if(starts(d, n, "\x1f\x8b", 2))
+        return L"GZIP";
+    if(starts(d, n, "BZh", 3) && n > 3 && d[3] >= '1' && d[3] <= '9')
+        return L"BZIP2";
+    if(starts(d, n, "\xfd" "7zXZ\x00", 6))
+        return L"XZ";
+    if(starts(d, n, "\x28\xb5\x2f\xfd", 4))
+        return L"ZSTD";
+    if(starts(d, n, "MSCF\x00\x00\x00\x00", 8))
+        return L"CAB";
+    if(starts(d, n, "ustar", 5, 257))
+        return L"TAR";
+
+    /* documents and images */
+    if(starts(d, n, "%PDF-", 5))
+        return L"PDF";
+    if(starts(d, n, "\x89PNG\r\n\x1a\n", 8))
+        return L"PNG";
+    if(starts(d, n, "\xff\xd8\xff", 3))
+        return L"JPEG";
+    if(starts(d, n, "GIF87a", 6) || starts(d, n, "GIF89a", 6))
+        return L"GIF";
+    if(starts(d, n, "RIFF", 4) && starts(d, n, "WEBP", 4, 8))
+        return L"WEBP";
+    if(starts(d, n, "II*\x00", 4) || starts(d, n, "MM\x00*", 4))
+        return L"TIFF";
+    if(starts(d, n, "BM", 2) && starts(d, n, "\x00\x00\x00\x00", 4, 6))
+        return L"BMP";
+    if(starts(d, n, "\x00\x00\x01\x00", 4) && n > 4 && d[4] != 0)
+        return L"ICO";
+
+    /* executables */
+    if(starts(d, n, "MZ", 2))
+        return L"EXE";
+    if(starts(d, n, "\x7f" "ELF", 4))
+        return L"ELF";
+
+    /* launchers and text */
+    if(starts(d, n, "\xff\xfe", 2))
+        return L"UTF-16LE";
+    if(starts(d, n, "\xfe\xff", 2))
+        return L"UTF-16BE";
+    std::size_t bom = starts(d, n, "\xef\xbb\xbf", 3) ? 3 : 0;
+    if(starts(d, n, "[InternetShortcut]", 18, bom) || starts(d, n, "[{000214A0-0000-0000-C000-000000000046}]", 40, bom))
+        return L"URL";
+    if(contains(d, n, "[Desktop Entry]"))
+        return L"DESKTOP";
+    return bom ? L"UTF-8-BOM" : text(d, n);
+}
+
+/* one positional read of the first SNIFF_SIZE bytes. NULL when the file can't be read */
+inline const wchar_t* sniff_file(const std::filesystem::path& p) {
+    unsigned char buf[SNIFF_SIZE];
+#ifdef _WIN32
+    HANDLE h = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(h == INVALID_HANDLE_VALUE)
+        return NULL;
+    DWORD got = 0;
+    BOOL ok = ReadFile(h, buf, (DWORD)sizeof(buf), &got, NULL);
+    CloseHandle(h);
+    if(!ok)
+        return NULL;
+#else
+    int fd = open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return NULL;
+    ssize_t got = pread(fd, buf, sizeof(buf), 0);
+    close(fd);
+    if(got < 0)
+        return NULL;
+#endif
+    return sniff(buf, (std::size_t)got);
+}
+
+#endif /* _FILETYPE_HPP_ */
@@ -25,21 +25,26 @@ SOFTWARE.
 
 *** */
 
+#ifndef _LIBLNK_HPP_
+#define _LIBLNK_HPP_
+
 #define PRODUCT_VERSION "0.1.0"
 
-// #include <stdint.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 // #include <stdio.h>
 // #include <iostream>
 #include <assert.h>
-#include <direct.h>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
 #ifdef _WIN32
+#include <direct.h>
 #include <Windows.h>  //for GetShortPathName()
-#define stat _stat
 #endif
 // #include <memory.h>
 // #include <string.h>  //for strlen()
@@ -51,6 +56,522 @@ SOFTWARE.
 // #include <ctime>    //for random
 #include <iomanip>  //for std::hex, std::setfill, std::setw
 
+///< summary>
+/// A StringData field of a link: UTF-16LE when the link has the IsUnicode flag, ANSI otherwise.
+/// bytes points into the parsed buffer, so it is not aligned and not NUL terminated.
+///</summary>
+struct LnkText {
+    std::string_view bytes;
+    bool utf16 = false;
+
+    bool empty() const { return bytes.empty(); }
+    std::size_t length() const { return utf16 ? bytes.size() / 2 : bytes.size(); }
+    uint16_t at(std::size_t i) const {
+        if(!utf16)
+            return (unsigned char)bytes[i];
+        return (uint16_t)((unsigned char)bytes[2 * i] | ((unsigned char)bytes[2 * i + 1] << 8));
+    }
+};
+
+///< summary>
+/// Read-only view of a shell link (MS-SHLLINK) parsed in place.
+/// Every field is read as little-endian bytes and checked against the span, nothing is copied or allocated,
+/// and the views stay valid as long as the buffer does. Works the same on every platform.
+/// A span cut short after LinkInfo still parses: the StringData fields past its end are left empty
+/// and complete is false.
+///</summary>
+class LnkView {
+   public:
+    uint32_t linkFlags = 0;
+    uint32_t fileAttributes = 0;
+    uint64_t creationTime = 0;  // FILETIME, 100ns since 1601-01-01 UTC
+    uint64_t accessTime = 0;
+    uint64_t writeTime = 0;
+    uint32_t fileSize = 0;
+
+    std::string_view target;       // LocalBasePath, ANSI
+    std::string_view networkPath;  // NetName of the share, e.g. \\server\share, ANSI
+    std::string_view pathSuffix;   // CommonPathSuffix, the rest of the path below networkPath, ANSI
+    LnkText description;
+    LnkText relativePath;
+    LnkText workingDirectory;
+    LnkText arguments;
+    LnkText iconLocation;
+    std::size_t linkInfoOffset = 0;    // where LinkInfo starts in the file, 0 when there is none
+    std::size_t stringDataOffset = 0;  // where the StringData fields start, 0 when LinkInfo could not be read
+    bool complete = false;
+
+    static const uint32_t HAS_LINK_TARGET_ID_LIST = 0x01;
+    static const uint32_t HAS_LINK_INFO = 0x02;
+    static const uint32_t HAS_NAME = 0x04;
+    static const uint32_t HAS_RELATIVE_PATH = 0x08;
+    static const uint32_t HAS_WORKING_DIR = 0x10;
+    static const uint32_t HAS_ARGUMENTS = 0x20;
+    static const uint32_t HAS_ICON_LOCATION = 0x40;
+    static const uint32_t IS_UNICODE = 0x80;
+    static const uint32_t FORCE_NO_LINK_INFO = 0x100;
+
+    bool isNetwork() const { return target.empty() && !networkPath.empty(); }
+
+    ///< summary>
+    /// Whether [iData, iData + iSize) starts with a ShellLinkHeader: its size and LinkCLSID.
+    ///</summary>
+    static bool isShellLink(const unsigned char* iData, std::size_t iSize) {
+        static const unsigned char clsid[16] = {0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                                0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46};
+        return iSize >= 4 + sizeof(clsid) && le32(iData) == HEADER_SIZE && memcmp(iData + 4, clsid, sizeof(clsid)) == 0;
+    }
+
+    ///< summary>
+    /// Parses the link in [iData, iData + iSize).
+    ///</summary>
+    ///< return>Returns false when the header is not a shell link or LinkInfo is malformed.<return>
+    bool parse(const unsigned char* iData, std::size_t iSize) {
+        *this = LnkView();
+        if(iSize < HEADER_SIZE || !isShellLink(iData, iSize))
+            return false;
+        linkFlags = le32(iData + 0x14);
+        fileAttributes = le32(iData + 0x18);
+        creationTime = le64(iData + 0x1c);
+        accessTime = le64(iData + 0x24);
+        writeTime = le64(iData + 0x2c);
+        fileSize = le32(iData + 0x34);
+
+        std::size_t offset = HEADER_SIZE;
+        if(linkFlags & HAS_LINK_TARGET_ID_LIST) {
+            if(iSize - offset < 2)
+                return false;
+            offset += 2 + le16(iData + offset);
+        }
+        if((linkFlags & HAS_LINK_INFO) && !(linkFlags & FORCE_NO_LINK_INFO)) {
+            linkInfoOffset = offset;
+            if(offset > iSize || !parseLinkInfo(iData + offset, iSize - offset))
+                return false;
+            offset += le32(iData + offset);
+        }
+        stringDataOffset = offset;
+        if(offset <= iSize)
+            parseStringData(iData + offset, iSize - offset);
+        return true;
+    }
+
+    ///< summary>
+    /// Parses the StringData fields on their own, for callers that read them separately.
+    /// iData is the file from stringDataOffset on; linkFlags must be set by a parse() of the header.
+    ///</summary>
+    ///< return>Returns complete: false when the span ends before the last field.<return>
+    bool parseStringData(const unsigned char* iData, std::size_t iSize) {
+        const uint32_t fields[] = {HAS_NAME, HAS_RELATIVE_PATH, HAS_WORKING_DIR, HAS_ARGUMENTS, HAS_ICON_LOCATION};
+        LnkText* texts[] = {&description, &relativePath, &workingDirectory, &arguments, &iconLocation};
+        std::size_t offset = 0;
+        complete = true;
+        for(int i = 0; i < 5; ++i) {
+            *texts[i] = LnkText();
+            if(complete && (linkFlags & fields[i]))
+                complete = readText(iData, iSize, offset, *texts[i]);
+        }
+        return complete;
+    }
+
+    ///< summary>
+    /// Parses a LinkInfo block on its own, for callers that read it separately from the header.
+    ///</summary>
+    ///< param name="iAvailable">The number of readable bytes at iInfo.</param>
+    bool parseLinkInfo(const unsigned char* iInfo, std::size_t iAvailable) {
+        if(iAvailable < 4)
+            return false;
+        uint32_t size = le32(iInfo);
+        if(size > iAvailable || size < 0x1c)
+            return false;
+        uint32_t flags = le32(iInfo + 0x08);
+        if(flags & 0x01) {  // VolumeIDAndLocalBasePath
+            if(!cstringAt(iInfo, size, le32(iInfo + 0x10), target))
+                return false;
+        }
+        if(flags & 0x02) {  // CommonNetworkRelativeLinkAndPathSuffix
+            uint32_t offset = le32(iInfo + 0x14);
+            if(offset == 0 || offset >= size || size - offset < 0x14)
+                return false;
+            const unsigned char* net = iInfo + offset;
+            uint32_t netSize = le32(net);
+            if(netSize < 0x14 || netSize > size - offset || !cstringAt(net, netSize, le32(net + 0x08), networkPath))
+                return false;
+        }
+        cstringAt(iInfo, size, le32(iInfo + 0x18), pathSuffix);
+        stringDataOffset = linkInfoOffset + size;
+        complete = false;
+        return true;
+    }
+
+   private:
+    static const uint32_t HEADER_SIZE = 0x4c;
+
+    static uint16_t le16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+    static uint32_t le32(const unsigned char* p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    static uint64_t le64(const unsigned char* p) { return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32); }
+
+    // NUL terminated ANSI string at iOffset inside [0, iSize)
+    static bool cstringAt(const unsigned char* iData, std::size_t iSize, uint32_t iOffset, std::string_view& oValue) {
+        if(iOffset == 0 || iOffset >= iSize)
+            return false;
+        const void* end = memchr(iData + iOffset, 0, iSize - iOffset);
+        if(end == NULL)
+            return false;
+        oValue = std::string_view((const char*)iData + iOffset, (const unsigned char*)end - (iData + iOffset));
+        return true;
+    }
+
+    // a CountedString: 16bit character count, then the characters
+    bool readText(const unsigned char* iData, std::size_t iSize, std::size_t& ioOffset, LnkText& oValue) const {
+        if(ioOffset > iSize || iSize - ioOffset < 2)
+            return false;
+        std::size_t bytes = (std::size_t)le16(iData + ioOffset) * ((linkFlags & IS_UNICODE) ? 2 : 1);
+        if(iSize - ioOffset - 2 < bytes)
+            return false;
+        oValue.bytes = std::string_view((const char*)iData + ioOffset + 2, bytes);
+        oValue.utf16 = (linkFlags & IS_UNICODE) != 0;
+        ioOffset += 2 + bytes;
+        return true;
+    }
+};
+
+///< summary>
+/// Replaces a path prefix or fragment in a shell link held in memory, keeping every other byte.
+/// The ANSI and Unicode local base path and network name in LinkInfo, the working directory in
+/// StringData and the targets of an EnvironmentVariableDataBlock are rewritten; the header (show
+/// command, times, attributes, hot key), the relative path, arguments, icon and the other extra
+/// data blocks are copied as they are. When LinkInfo changes, the LinkTargetIDList is dropped with
+/// the blocks that point into it: it spells out the old location, and without it Windows resolves
+/// the link through LinkInfo. Nothing here needs the target to exist.
+///</summary>
+class LnkRewriter {
+   public:
+    ///< param name="iBefore">The text to replace, as ANSI bytes and as UTF-16.</param>
+    LnkRewriter(std::string iBefore, std::string iAfter, std::u16string iBefore16, std::u16string iAfter16)
+        : before(std::move(iBefore)), after(std::move(iAfter)), before16(std::move(iBefore16)), after16(std::move(iAfter16)) {}
+
+    ///< summary>
+    /// Rewrites the link in [iData, iData + iSize) into oLink. oChanged is false, and oLink empty,
+    /// when no path matched.
+    ///</summary>
+    ///< return>Returns false when the link is malformed or a rewritten field does not fit.<return>
+    bool rewrite(const unsigned char* iData, std::size_t iSize, std::vector<unsigned char>& oLink, bool& oChanged) const {
+        oLink.clear();
+        oChanged = false;
+        LnkView view;
+        if(!view.parse(iData, iSize) || !view.complete)
+            return false;
+        std::vector<unsigned char> info, strings, extra;
+        bool infoChanged = false, stringsChanged = false, extraChanged = false;
+        if(view.linkInfoOffset && !rewriteLinkInfo(iData + view.linkInfoOffset, view.stringDataOffset - view.linkInfoOffset,
+                                                   info, infoChanged))
+            return false;
+        std::size_t extraOffset = view.stringDataOffset;
+        if(!rewriteStringData(view.linkFlags, iData, iSize, extraOffset, strings, stringsChanged))
+            return false;
+        bool dropIdList = infoChanged && (view.linkFlags & LnkView::HAS_LINK_TARGET_ID_LIST);
+        if(!rewriteExtraData(iData + extraOffset, iSize - extraOffset, dropIdList, extra, extraChanged))
+            return false;
+        oChanged = infoChanged || stringsChanged || extraChanged;
+        if(!oChanged)
+            return true;
+
+        const std::size_t header = 0x4c;
+        oLink.assign(iData, iData + header);
+        std::size_t idEnd = view.linkInfoOffset ? view.linkInfoOffset : view.stringDataOffset;
+        if(dropIdList) {
+            uint32_t flags = view.linkFlags & ~LnkView::HAS_LINK_TARGET_ID_LIST;
+            for(int i = 0; i < 4; ++i)
+                oLink[0x14 + i] = (unsigned char)(flags >> (8 * i));
+        } else {
+            oLink.insert(oLink.end(), iData + header, iData + idEnd);
+        }
+        if(infoChanged)
+            oLink.insert(oLink.end(), info.begin(), info.end());
+        else if(view.linkInfoOffset)
+            oLink.insert(oLink.end(), iData + view.linkInfoOffset, iData + view.stringDataOffset);
+        oLink.insert(oLink.end(), strings.begin(), strings.end());
+        oLink.insert(oLink.end(), extra.begin(), extra.end());
+        return true;
+    }
+
+   private:
+    std::string before, after;
+    std::u16string before16, after16;
+
+    static uint32_t le32(const unsigned char* p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    static void put32(std::vector<unsigned char>& o, uint32_t v) {
+        for(int i = 0; i < 4; ++i)
+            o.push_back((unsigned char)(v >> (8 * i)));
+    }
+    static void set32(std::vector<unsigned char>& o, std::size_t at, uint32_t v) {
+        for(int i = 0; i < 4; ++i)
+            o[at + i] = (unsigned char)(v >> (8 * i));
+    }
+
+    // every occurrence of iFrom in ioValue, like stringfunc::strReplace
+    template <typename S>
+    static bool replaceAll(S& ioValue, const S& iFrom, const S& iTo) {
+        if(iFrom.empty())
+            return false;
+        bool found = false;
+        for(std::size_t at = ioValue.find(iFrom); at != S::npos; at = ioValue.find(iFrom, at + iTo.size())) {
+            ioValue.replace(at, iFrom.size(), iTo);
+            found = true;
+        }
+        return found;
+    }
+
+    // NUL terminated strings inside [0, iSize)
+    static bool ansiAt(const unsigned char* iData, std::size_t iSize, uint32_t iOffset, std::string& oValue) {
+        if(iOffset >= iSize)
+            return false;
+        const void* end = memchr(iData + iOffset, 0, iSize - iOffset);
+        if(end == NULL)
+            return false;
+        oValue.assign((const char*)iData + iOffset, (const unsigned char*)end - (iData + iOffset));
+        return true;
+    }
+    static bool unicodeAt(const unsigned char* iData, std::size_t iSize, uint32_t iOffset, std::u16string& oValue) {
+        oValue.clear();
+        for(std::size_t i = iOffset; i + 1 < iSize; i += 2) {
+            char16_t c = (char16_t)(iData[i] | (iData[i + 1] << 8));
+            if(c == 0)
+                return true;
+            oValue.push_back(c);
+        }
+        return false;
+    }
+    static void putAnsi(std::vector<unsigned char>& o, const std::string& s) {
+        o.insert(o.end(), s.begin(), s.end());
+        o.push_back(0);
+    }
+    static void putUnicode(std::vector<unsigned char>& o, const std::u16string& s) {
+        for(char16_t c : s) {
+            o.push_back((unsigned char)c);
+            o.push_back((unsigned char)(c >> 8));
+        }
+        o.push_back(0);
+        o.push_back(0);
+    }
+
+    // LinkInfo, laid out again around the rewritten strings
+    bool rewriteLinkInfo(const unsigned char* iInfo, std::size_t iSize, std::vector<unsigned char>& oInfo, bool& oChanged) const {
+        if(iSize < 0x1c || le32(iInfo) != iSize)
+            return false;
+        uint32_t headerSize = le32(iInfo + 0x04), flags = le32(iInfo + 0x08);
+        bool unicode = headerSize >= 0x24;
+        if(headerSize < 0x1c || headerSize > iSize || (unicode && iSize < 0x24))
+            return false;
+        std::vector<unsigned char> volume, network;
+        std::string base, suffix;
+        std::u16string base16, suffix16;
+        bool hasBase16 = false, hasSuffix16 = false;
+        if(flags & 0x01) {
+            uint32_t at = le32(iInfo + 0x0c);
+            if(at > iSize || iSize - at < 4 || le32(iInfo + at) > iSize - at || le32(iInfo + at) < 4)
+                return false;
+            volume.assign(iInfo + at, iInfo + at + le32(iInfo + at));
+            if(!ansiAt(iInfo, iSize, le32(iInfo + 0x10), base))
+                return false;
+            oChanged |= replaceAll(base, before, after);
+            if(unicode && le32(iInfo + 0x1c)) {
+                if(!unicodeAt(iInfo, iSize, le32(iInfo + 0x1c), base16))
+                    return false;
+                hasBase16 = true;
+                oChanged |= replaceAll(base16, before16, after16);
+            }
+        }
+        if(flags & 0x02) {
+            uint32_t at = le32(iInfo + 0x14);
+            if(at == 0 || at > iSize || iSize - at < 0x14 || le32(iInfo + at) > iSize - at || le32(iInfo + at) < 0x14)
+                return false;
+            if(!rewriteNetwork(iInfo + at, le32(iInfo + at), network, oChanged))
+                return false;
+        }
+        if(le32(iInfo + 0x18) < headerSize || !ansiAt(iInfo, iSize, le32(iInfo + 0x18), suffix))
+            suffix.clear();
+        if(unicode && le32(iInfo + 0x20))
+            hasSuffix16 = unicodeAt(iInfo, iSize, le32(iInfo + 0x20), suffix16);
+        if(!oChanged)
+            return true;
+
+        // header, VolumeID, LocalBasePath, CommonNetworkRelativeLink, CommonPathSuffix, then the Unicode strings
+        const uint32_t header = unicode ? 0x24 : 0x1c;
+        oInfo.assign(header, 0);
+        set32(oInfo, 0x04, header);
+        set32(oInfo, 0x08, flags & 0x03);
+        if(flags & 0x01) {
+            set32(oInfo, 0x0c, (uint32_t)oInfo.size());
+            oInfo.insert(oInfo.end(), volume.begin(), volume.end());
+            set32(oInfo, 0x10, (uint32_t)oInfo.size());
+            putAnsi(oInfo, base);
+        }
+        if(flags & 0x02) {
+            set32(oInfo, 0x14, (uint32_t)oInfo.size());
+            oInfo.insert(oInfo.end(), network.begin(), network.end());
+        }
+        set32(oInfo, 0x18, (uint32_t)oInfo.size());
+        putAnsi(oInfo, suffix);
+        if(hasBase16) {
+            set32(oInfo, 0x1c, (uint32_t)oInfo.size());
+            putUnicode(oInfo, base16);
+        }
+        if(hasSuffix16) {
+            set32(oInfo, 0x20, (uint32_t)oInfo.size());
+            putUnicode(oInfo, suffix16);
+        }
+        set32(oInfo, 0x00, (uint32_t)oInfo.size());
+        return true;
+    }
+
+    // CommonNetworkRelativeLink with the net name rewritten; the device name and provider are kept
+    bool rewriteNetwork(const unsigned char* iLink, std::size_t iSize, std::vector<unsigned char>& oLink, bool& oChanged) const {
+        uint32_t flags = le32(iLink + 0x04), netAt = le32(iLink + 0x08), deviceAt = le32(iLink + 0x0c);
+        bool unicode = netAt > 0x14;
+        if(unicode && iSize < 0x1c)
+            return false;
+        std::string net, device;
+        std::u16string net16, device16;
+        if(!ansiAt(iLink, iSize, netAt, net))
+            return false;
+        bool hasDevice = (flags & 0x01) && ansiAt(iLink, iSize, deviceAt, device);
+        bool hasNet16 = unicode && le32(iLink + 0x14) && unicodeAt(iLink, iSize, le32(iLink + 0x14), net16);
+        bool hasDevice16 = unicode && hasDevice && le32(iLink + 0x18) && unicodeAt(iLink, iSize, le32(iLink + 0x18), device16);
+        oChanged |= replaceAll(net, before, after);
+        if(hasNet16)
+            oChanged |= replaceAll(net16, before16, after16);
+
+        const uint32_t header = unicode ? 0x1c : 0x14;
+        oLink.assign(header, 0);
+        set32(oLink, 0x04, flags & (hasDevice ? 0x03 : 0x02));
+        set32(oLink, 0x10, le32(iLink + 0x10));  // NetworkProviderType
+        set32(oLink, 0x08, (uint32_t)oLink.size());
+        putAnsi(oLink, net);
+        if(hasDevice) {
+            set32(oLink, 0x0c, (uint32_t)oLink.size());
+            putAnsi(oLink, device);
+        }
+        if(hasNet16) {
+            set32(oLink, 0x14, (uint32_t)oLink.size());
+            putUnicode(oLink, net16);
+        }
+        if(hasDevice16) {
+            set32(oLink, 0x18, (uint32_t)oLink.size());
+            putUnicode(oLink, device16);
+        }
+        set32(oLink, 0x00, (uint32_t)oLink.size());
+        return true;
+    }
+
+    // StringData with the working directory rewritten. ioOffset moves from its start to its end
+    bool rewriteStringData(uint32_t iFlags, const unsigned char* iData, std::size_t iSize, std::size_t& ioOffset,
+                           std::vector<unsigned char>& oStrings, bool& oChanged) const {
+        const uint32_t fields[] = {LnkView::HAS_NAME, LnkView::HAS_RELATIVE_PATH, LnkView::HAS_WORKING_DIR,
+                                   LnkView::HAS_ARGUMENTS, LnkView::HAS_ICON_LOCATION};
+        bool unicode = (iFlags & LnkView::IS_UNICODE) != 0;
+        for(uint32_t field : fields) {
+            if(!(iFlags & field))
+                continue;
+            if(ioOffset > iSize || iSize - ioOffset < 2)
+                return false;
+            std::size_t count = (std::size_t)(iData[ioOffset] | (iData[ioOffset + 1] << 8));
+            std::size_t bytes = count * (unicode ? 2 : 1);
+            if(iSize - ioOffset - 2 < bytes)
+                return false;
+            const unsigned char* text = iData + ioOffset + 2;
+            ioOffset += 2 + bytes;
+            if(field == LnkView::HAS_WORKING_DIR) {
+                std::vector<unsigned char> value;
+                if(unicode) {
+                    std::u16string s;
+                    for(std::size_t i = 0; i < count; ++i)
+                        s.push_back((char16_t)(text[2 * i] | (text[2 * i + 1] << 8)));
+                    if(replaceAll(s, before16, after16)) {
+                        oChanged = true;
+                        putUnicode(value, s);
+                        value.resize(value.size() - 2);
+                        count = s.size();
+                    }
+                } else {
+                    std::string s((const char*)text, count);
+                    if(replaceAll(s, before, after)) {
+                        oChanged = true;
+                        value.assign(s.begin(), s.end());
+                        count = s.size();
+                    }
+                }
+                if(!value.empty() || count == 0) {
+                    if(count > 0xffff)
+                        return false;
+                    oStrings.push_back((unsigned char)count);
+                    oStrings.push_back((unsigned char)(count >> 8));
+                    oStrings.insert(oStrings.end(), value.begin(), value.end());
+                    continue;
+                }
+            }
+            oStrings.insert(oStrings.end(), text - 2, text + bytes);
+        }
+        return true;
+    }
+
+    // ExtraData blocks up to and including the TerminalBlock
+    bool rewriteExtraData(const unsigned char* iData, std::size_t iSize, bool iDropIdList, std::vector<unsigned char>& oExtra,
+                          bool& oChanged) const {
+        const uint32_t ENVIRONMENT = 0xa0000001, SPECIAL_FOLDER = 0xa0000005, KNOWN_FOLDER = 0xa000000b,
+                       VISTA_ID_LIST = 0xa000000c;
+        std::size_t offset = 0;
+        for(;;) {
+            if(iSize - offset < 4)
+                return false;
+            uint32_t size = le32(iData + offset);
+            if(size < 4) {
+                put32(oExtra, 0);
+                return true;
+            }
+            if(size < 8 || size > iSize - offset)
+                return false;
+            const unsigned char* block = iData + offset;
+            offset += size;
+            uint32_t signature = le32(block + 4);
+            if(iDropIdList && (signature == SPECIAL_FOLDER || signature == KNOWN_FOLDER || signature == VISTA_ID_LIST))
+                continue;
+            std::size_t at = oExtra.size();
+            oExtra.insert(oExtra.end(), block, block + size);
+            if(signature == ENVIRONMENT && size >= 0x314 && !rewriteEnvironment(&oExtra[at], oChanged))
+                return false;
+        }
+    }
+
+    // TargetAnsi (260 bytes) and TargetUnicode (260 characters), rewritten in place
+    bool rewriteEnvironment(unsigned char* ioBlock, bool& oChanged) const {
+        std::string ansi;
+        std::u16string wide;
+        if(!ansiAt(ioBlock + 8, 260, 0, ansi) || !unicodeAt(ioBlock + 268, 520, 0, wide))
+            return true;  // not terminated: left as it is
+        bool a = replaceAll(ansi, before, after), w = replaceAll(wide, before16, after16);
+        if((a && ansi.size() >= 260) || (w && wide.size() >= 260))
+            return false;
+        if(a) {
+            memset(ioBlock + 8, 0, 260);
+            memcpy(ioBlock + 8, ansi.data(), ansi.size());
+        }
+        if(w) {
+            memset(ioBlock + 268, 0, 520);
+            for(std::size_t i = 0; i < wide.size(); ++i) {
+                ioBlock[268 + 2 * i] = (unsigned char)wide[i];
+                ioBlock[268 + 2 * i + 1] = (unsigned char)(wide[i] >> 8);
+            }
+        }
+        oChanged |= a || w;
+        return true;
+    }
+};
+
 namespace stringfunc {
 
 ///< summary>
@@ -76,13 +597,16 @@ int strReplace(std::string& iString, const char* iOldValue, const char* iNewValu
                 startPos = findPos + tmpNewValue.length();
                 numOccurance++;
             }
-        } while(findPos != -1);
+        } while(findPos != std::string::npos);
     }
     return numOccurance;
 }
 
 };  // namespace stringfunc
 
+// the read/write API below uses the Win32 CRT and FILETIME
+#ifdef _WIN32
+
 namespace filesystem {
 
 ///< summary>
@@ -132,11 +656,9 @@ bool folderExists(const char* iPath) {
     if(iPath == NULL || iPath[0] == '\0')
         return false;
 
-    const char* localFolder = _getcwd(NULL, 0);
-    bool success = (_chdir(iPath) == 0);
-    if(success && localFolder)
-        _chdir(localFolder);
-    return success;
+    // not by changing into it: the working directory is shared by every thread of the process
+    DWORD attributes = GetFileAttributesA(iPath);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
 }
 
 ///< summary>
@@ -262,7 +784,7 @@ std::string getShortPathFormEstimation(const std::string& iPath) {
 }
 
 std::string getShortPathForm(const std::string& iPath) {
-#ifdef WIN32
+#ifdef _WIN32
     if(fileExists(iPath.c_str()) || folderExists(iPath.c_str())) {
         // file must exist to use WIN32 api
         std::string shortPath;
@@ -290,7 +812,7 @@ std::string getShortPathForm(const std::string& iPath) {
     } else {
         return getShortPathFormEstimation(iPath);
     }
-#elif UNIX
+#else
     // no such thing as short path form in unix
     return getShortPathFormEstimation(iPath);
 #endif
@@ -560,49 +1082,127 @@ struct LNK_ITEMID {
 
 // namespace lnk {
 
+///< summary>
+/// Bump allocator for MemoryBuffer storage. Memory is only handed back by reset(), which keeps one
+/// block as large as everything used, up to iMaxKept bytes, so a loop that resets the arena per link
+/// stops allocating once it is warm and one oversized link does not pin its memory for good.
+/// Buffers drawing from an arena must not be used after its reset() or destruction.
+///</summary>
+class LnkArena {
+   public:
+    explicit LnkArena(std::size_t iBlockSize = 64 * 1024, std::size_t iMaxKept = 1024 * 1024)
+        : mBlockSize(iBlockSize), mMaxKept(iMaxKept), mUsed(0) {}
+    LnkArena(const LnkArena&) = delete;
+    LnkArena& operator=(const LnkArena&) = delete;
+
+    unsigned char* take(std::size_t iSize) {
+        iSize = (iSize + 15) & ~(std::size_t)15;
+        if(mBlocks.empty() || mUsed + iSize > mBlocks.back().size) {
+            std::size_t size = iSize > mBlockSize ? iSize : mBlockSize;
+            mBlocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+            mUsed = 0;
+        }
+        unsigned char* p = mBlocks.back().data.get() + mUsed;
+        mUsed += iSize;
+        return p;
+    }
+
+    void reset() {
+        std::size_t total = 0;
+        for(size_t i = 0; i < mBlocks.size(); i++)
+            total += mBlocks[i].size;
+        // keep one block as large as everything used, so the next round fits in it, but no larger than mMaxKept
+        std::size_t keep = total < mMaxKept ? total : mMaxKept;
+        if(mBlocks.size() > 1 || total > keep) {
+            mBlocks.clear();
+            if(keep > 0)
+                mBlocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[keep]), keep});
+        }
+        mUsed = 0;
+    }
+
+    ///< summary>
+    /// While a Scope is alive, MemoryBuffers created on this thread without an arena draw from iArena.
+    ///</summary>
+    class Scope {
+       public:
+        explicit Scope(LnkArena& iArena) : mPrevious(current()) { current() = &iArena; }
+        ~Scope() { current() = mPrevious; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+       private:
+        LnkArena* mPrevious;
+    };
+    static LnkArena*& current() {
+        static thread_local LnkArena* arena = NULL;
+        return arena;
+    }
+
+   private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        std::size_t size;
+    };
+    std::vector<Block> mBlocks;
+    std::size_t mBlockSize;
+    std::size_t mMaxKept;
+    std::size_t mUsed;
+};
+
+///< summary>
+/// Growable byte buffer. Capacity grows geometrically, so appending with serialize() is amortized O(1),
+/// and buffers are moved rather than copied when returned. Storage comes from the heap, or from the
+/// LnkArena of the enclosing LnkArena::Scope when there is one.
+///</summary>
 class MemoryBuffer {
    public:
-    MemoryBuffer(void) : mBuffer(NULL), mSize(0){};
-    MemoryBuffer(unsigned long iSize) : mBuffer(NULL), mSize(0) { allocate(iSize); }
-    MemoryBuffer(const MemoryBuffer& iValue) : mBuffer(NULL), mSize(0) { (*this) = iValue; }
+    MemoryBuffer(void) : mBuffer(NULL), mSize(0), mCapacity(0), mArena(LnkArena::current()){};
+    MemoryBuffer(unsigned long iSize) : mBuffer(NULL), mSize(0), mCapacity(0), mArena(LnkArena::current()) {
+        allocate(iSize);
+    }
+    MemoryBuffer(const MemoryBuffer& iValue) : mBuffer(NULL), mSize(0), mCapacity(0), mArena(LnkArena::current()) {
+        (*this) = iValue;
+    }
+    MemoryBuffer(MemoryBuffer&& iValue) noexcept
+        : mBuffer(iValue.mBuffer), mSize(iValue.mSize), mCapacity(iValue.mCapacity), mArena(iValue.mArena) {
+        iValue.mBuffer = NULL;
+        iValue.mSize = iValue.mCapacity = 0;
+    }
     virtual ~MemoryBuffer(void) { clear(); }
 
     //----------------
     // public methods
     //----------------
     void clear() {
-        if(mBuffer) {
+        if(mBuffer && !mArena) {
             delete[] mBuffer;
         }
         mBuffer = NULL;
         mSize = 0;
+        mCapacity = 0;
     }
     unsigned char* getBuffer() { return mBuffer; }
     const unsigned char* getBuffer() const { return mBuffer; }
+    // resizes without keeping the content
     bool allocate(unsigned long iSize) {
-        clear();
-        mBuffer = new unsigned char[iSize];
-        if(mBuffer) {
-            mSize = iSize;
-            return true;
+        if(iSize > mCapacity) {
+            clear();
+            if(!grow(iSize, false))
+                return false;
         }
-        return false;
+        mSize = iSize;
+        return true;
     }
+    // resizes keeping the content
     bool reallocate(unsigned long iSize) {
-        unsigned char* newBuffer = new unsigned char[iSize];
-        if(newBuffer) {
-            // if the current memory buffer has data
-            if(mBuffer) {
-                // copy the content of the existing buffer to newBuffer
-                memcpy(newBuffer, mBuffer, (((mSize) < (iSize)) ? (mSize) : (iSize)));
-            }
-
-            clear();
-            mBuffer = newBuffer;
-            mSize = iSize;
-            return true;
+        if(iSize > mCapacity) {
+            unsigned long capacity = mCapacity < 64 ? 64 : mCapacity * 2;
+            if(!grow(capacity > iSize ? capacity : iSize, true))
+                return false;
         }
-        return false;
+        mSize = iSize;
+        return true;
     }
     unsigned long getSize() const { return mSize; }
     bool loadFile(const char* iFilePath) {
@@ -624,14 +1224,41 @@ class MemoryBuffer {
     }
 
     const MemoryBuffer& operator=(const MemoryBuffer& iValue) {
-        if(allocate(iValue.mSize))
+        if(this != &iValue && allocate(iValue.mSize) && mSize)
             memcpy(mBuffer, iValue.mBuffer, mSize);
         return (*this);
     }
+    MemoryBuffer& operator=(MemoryBuffer&& iValue) noexcept {
+        if(this != &iValue) {
+            clear();
+            mBuffer = iValue.mBuffer;
+            mSize = iValue.mSize;
+            mCapacity = iValue.mCapacity;
+            mArena = iValue.mArena;
+            iValue.mBuffer = NULL;
+            iValue.mSize = iValue.mCapacity = 0;
+        }
+        return (*this);
+    }
 
    private:
+    bool grow(unsigned long iCapacity, bool iKeep) {
+        unsigned char* newBuffer = mArena ? mArena->take(iCapacity) : new unsigned char[iCapacity];
+        if(!newBuffer)
+            return false;
+        if(iKeep && mBuffer && mSize)
+            memcpy(newBuffer, mBuffer, mSize);
+        if(mBuffer && !mArena)
+            delete[] mBuffer;
+        mBuffer = newBuffer;
+        mCapacity = iCapacity;
+        return true;
+    }
+
     unsigned char* mBuffer;
     unsigned long mSize;
+    unsigned long mCapacity;
+    LnkArena* mArena;  // not owned. NULL: heap
 };
 
 std::string toTimeString(const unsigned __int64& iTime) {
@@ -797,9 +1424,7 @@ inline bool serialize(const T& iValue, MemoryBuffer& ioBuffer) {
     unsigned long newSize = oldSize + dataSize;
     if(ioBuffer.reallocate(newSize)) {
         // save data
-        unsigned char* buffer = ioBuffer.getBuffer();
-        T* offset = (T*)&buffer[oldSize];
-        *offset = iValue;
+        memcpy(ioBuffer.getBuffer() + oldSize, &iValue, dataSize);
 
         return true;
     }
@@ -811,11 +1436,7 @@ inline bool serialize(const unsigned char* iData, const unsigned long& iSize, Me
     unsigned long newSize = oldSize + iSize;
     if(ioBuffer.reallocate(newSize)) {
         // save data
-        unsigned char* buffer = ioBuffer.getBuffer();
-        unsigned char* offset = &buffer[oldSize];
-        for(unsigned long i = 0; i < iSize; i++) {
-            offset[i] = iData[i];
-        }
+        memcpy(ioBuffer.getBuffer() + oldSize, iData, iSize);
 
         return true;
     }
@@ -1851,29 +2472,53 @@ bool printLinkInfo(const char* iFilePath) {
     return false;
 }
 
+///< summary>
+/// Replaces a pattern in the target, network path and working directory of a link with LnkRewriter,
+/// so every other field is kept. The result goes to a unique temporary file next to iFilePath that is
+/// renamed over it; a link the pattern does not match is left untouched.
+///</summary>
 bool changeLink(const char* iFilePath, const char* before_pattern, const char* after_pattern) {
-    LinkInfo info_bf, info_af;
-    if(!getLinkInfo(iFilePath, info_bf))
+    // the patterns are ANSI; LinkInfo also holds the paths in UTF-16
+    auto widen = [](const char* iText) {
+        std::u16string out;
+        int n = MultiByteToWideChar(CP_ACP, 0, iText, -1, NULL, 0);
+        if(n > 1) {
+            std::wstring w((std::size_t)n, L'\0');
+            MultiByteToWideChar(CP_ACP, 0, iText, -1, &w[0], n);
+            out.assign(w.begin(), w.end() - 1);
+        }
+        return out;
+    };
+    MemoryBuffer fileContent;
+    if(!fileContent.loadFile(iFilePath))
         return false;
-
-    info_af.arguments = info_bf.arguments;
-    info_af.description = info_bf.description;
-    info_af.customIcon.filename = info_bf.customIcon.filename;
-    info_af.customIcon.index = info_bf.customIcon.index;
-    info_af.hotKey.keyCode = info_bf.hotKey.keyCode;
-    info_af.hotKey.modifiers = info_bf.hotKey.modifiers;
-
-    info_af.target = stringfunc::strReplace(info_bf.target, before_pattern, after_pattern);
-    info_af.networkPath = stringfunc::strReplace(info_bf.networkPath, before_pattern, after_pattern);
-    info_af.workingDirectory = stringfunc::strReplace(info_bf.workingDirectory, before_pattern, after_pattern);
-
-    if(remove(iFilePath) != 0)
+    LnkRewriter rewriter(before_pattern, after_pattern, widen(before_pattern), widen(after_pattern));
+    std::vector<unsigned char> link;
+    bool changed = false;
+    if(!rewriter.rewrite(fileContent.getBuffer(), fileContent.getSize(), link, changed))
         return false;
+    if(!changed)
+        return true;
 
-    return createLink(iFilePath, info_af);
+    std::string folder = iFilePath;
+    std::size_t slash = folder.find_last_of("\\/");
+    folder = slash == std::string::npos ? std::string(".") : folder.substr(0, slash + 1);
+    char tmp[MAX_PATH];
+    if(GetTempFileNameA(folder.c_str(), "lnk", 0, tmp) == 0)  // creates the file under a name no one else has
+        return false;
+    FILE* f = NULL;
+    bool ok = fopen_s(&f, tmp, "wb") == 0;
+    if(ok) {
+        ok = fwrite(link.data(), 1, link.size(), f) == link.size();
+        ok = fclose(f) == 0 && ok;
+    }
+    if(!ok || !MoveFileExA(tmp, iFilePath, MOVEFILE_REPLACE_EXISTING)) {
+        remove(tmp);
+        return false;
+    }
+    return true;
 }
 
-
 std::string getLinkpath(const char* iFilePath) {
     FILE* f;
     errno_t error = fopen_s(&f, iFilePath, "rb");
@@ -1941,3 +2586,7 @@ std::string getLinkpath(const char* iFilePath) {
     fclose(f);
     return "";
 }
+
+#endif  // _WIN32
+
+#endif  // _LIBLNK_HPP_
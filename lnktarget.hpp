@@ -0,0 +1,198 @@
+/* lnktarget.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _LNKTARGET_HPP_
+#define _LNKTARGET_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include "liblnk.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* what --display shows about a shortcut, copied out of the parse */
+struct LnkDetails {
+    std::string target;  /* as -l prints it, ANSI */
+    std::string network; /* \\server\share of a network target, ANSI */
+    std::wstring description;
+    std::wstring arguments;
+    std::wstring working_dir;
+};
+
+/*
+ * Target of a Windows shortcut (.lnk) read straight from the file into a fixed buffer.
+ * The first positional read covers the header and, for all but very long ID lists, LinkInfo
+ * and the strings after it; otherwise a second read fetches just the LinkInfo block. Nothing
+ * is allocated and the rest of the file is never read. Parsing is LnkView's, so shortcuts on
+ * a share mounted on Linux resolve the same as on Windows.
+ * Strings are the ANSI forms, as stored, in the code page of the machine that wrote them.
+ */
+class LnkTarget {
+   public:
+    static const std::size_t BUFFER_SIZE = 8192;
+
+    /* local: base is the full path. network: base is \\server\share and suffix the rest */
+    const char* base = NULL;
+    std::size_t base_len = 0;
+    const char* suffix = NULL;
+    std::size_t suffix_len = 0;
+    bool network = false;
+    /* the whole parse, views into this object's buffer */
+    LnkView view;
+
+    bool read(const std::filesystem::path& p) {
+        clear();
+        File f(p);
+        return f.ok() && parse(f);
+    }
+
+    /* parses a file already in memory. data must stay alive while base and suffix are used */
+    bool parse(const unsigned char* data, std::size_t size) {
+        clear();
+        return view.parse(data, size) && resolve();
+    }
+
+    /*
+     * read() plus the StringData fields. They usually sit in the first read already; otherwise
+     * one more bounded read fetches them from where LinkInfo ends
+     */
+    bool read_details(const std::filesystem::path& p, LnkDetails& d) {
+        d = LnkDetails();
+        clear();
+        File f(p);
+        if(!f.ok() || !parse(f))
+            return false;
+        d.target.assign(base, base_len);
+        if(suffix_len) {
+            if(network)
+                d.target += '\\';
+            d.target.append(suffix, suffix_len);
+        }
+        d.network.assign(view.networkPath.data(), view.networkPath.size());
+        if(!view.complete && view.stringDataOffset)
+            view.parseStringData(buf, f.read_at(view.stringDataOffset, buf, sizeof(buf)));
+        widen(view.description, d.description);
+        widen(view.arguments, d.arguments);
+        widen(view.workingDirectory, d.working_dir);
+        return true;
+    }
+
+   private:
+    /* read-only handle for positional reads */
+    struct File {
+#ifdef _WIN32
+        HANDLE h;
+        explicit File(const std::filesystem::path& p)
+            : h(CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) {}
+        ~File() {
+            if(ok())
+                CloseHandle(h);
+        }
+        bool ok() const { return h != INVALID_HANDLE_VALUE; }
+        std::size_t read_at(uint64_t off, unsigned char* dst, std::size_t n) const {
+            OVERLAPPED ov = {0};
+            ov.Offset = (DWORD)off;
+            ov.OffsetHigh = (DWORD)(off >> 32);
+            DWORD got = 0;
+            return ReadFile(h, dst, (DWORD)n, &got, &ov) ? got : 0;
+        }
+#else
+        int h;
+        explicit File(const std::filesystem::path& p) : h(open(p.c_str(), O_RDONLY | O_CLOEXEC)) {}
+        ~File() {
+            if(ok())
+                close(h);
+        }
+        bool ok() const { return h >= 0; }
+        std::size_t read_at(uint64_t off, unsigned char* dst, std::size_t n) const {
+            ssize_t got = pread(h, dst, n, (off_t)off);
+            return got < 0 ? 0 : (std::size_t)got;
+        }
+#endif
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+    };
+
+    unsigned char buf[BUFFER_SIZE];
+
+    void clear() {
+        base = suffix = NULL;
+        base_len = suffix_len = 0;
+        network = false;
+    }
+
+    /* UTF-16 strings as they are (joined into code points where wchar_t is 32 bits), ANSI ones through the code page */
+    static void widen(const LnkText& t, std::wstring& out) {
+        out.clear();
+        if(t.utf16) {
+            for(std::size_t i = 0; i < t.length(); ++i) {
+                wchar_t c = (wchar_t)t.at(i);
+#ifndef _WIN32
+                if(c >= 0xd800 && c < 0xdc00 && i + 1 < t.length() && t.at(i + 1) >= 0xdc00 && t.at(i + 1) < 0xe000)
+                    c = 0x10000 + ((c - 0xd800) << 10) + (t.at(++i) - 0xdc00);
+#endif
+                out.push_back(c);
+            }
+            return;
+        }
+        if(t.bytes.empty())
+            return;
+#ifdef _WIN32
+        int n = MultiByteToWideChar(CP_ACP, 0, t.bytes.data(), (int)t.bytes.size(), NULL, 0);
+        if(n > 0) {
+            out.resize((std::size_t)n);
+            MultiByteToWideChar(CP_ACP, 0, t.bytes.data(), (int)t.bytes.size(), &out[0], n);
+            return;
+        }
+#else
+        /* the locale's multibyte encoding; mbstowcs wants a terminated string */
+        std::string s(t.bytes);
+        std::size_t n = mbstowcs(NULL, s.c_str(), 0);
+        if(n != (std::size_t)-1) {
+            out.resize(n);
+            mbstowcs(&out[0], s.c_str(), n);
+            return;
+        }
+#endif
+        /* not valid in the code page: one character per byte */
+        for(char c : t.bytes)
+            out.push_back((wchar_t)(unsigned char)c);
+    }
+
+    bool resolve() {
+        std::string_view b = view.target.empty() ? view.networkPath : view.target;
+        if(b.empty())
+            return false;
+        base = b.data();
+        base_len = b.size();
+        suffix = view.pathSuffix.data();
+        suffix_len = view.pathSuffix.size();
+        network = view.isNetwork();
+        return true;
+    }
+
+    bool parse(const File& f) {
+        std::size_t got = f.read_at(0, buf, sizeof(buf));
+        if(view.parse(buf, got))
+            return resolve();
+        if(got < sizeof(buf) || view.linkInfoOffset == 0)
+            return false; /* the whole file was read, or it has no LinkInfo */
+
+        /* a long ID list pushed LinkInfo past the first read: fetch just that block */
+        got = f.read_at(view.linkInfoOffset, buf, sizeof(buf));
+        return view.parseLinkInfo(buf, got) && resolve();
+    }
+};
+
+#endif /* _LNKTARGET_HPP_ */
@@ -1,6 +1,29 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cwchar>
+#include <cwctype>
 #include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "archive.hpp"
 #include "argparser.hpp"
+#include "dirstate.hpp"
+#include "dirwalk.hpp"
+#include "filehash.hpp"
+#include "filetype.hpp"
+#include "lnktarget.hpp"
+#include "mmapcache.hpp"
+#include "openhash.hpp"
+#include "records.hpp"
+#include "spool.hpp"
+#include "watch.hpp"
 
 namespace fs = std::filesystem;
 
@@ -14,14 +37,17 @@ static wchar_t DATETIME_FORMAT[] = L"%Y/%m/%d_%H:%M:%S";
 static wchar_t DEFAULT_SEPARATOR[] = L"\t";
 static wchar_t DEFAULT_DISPLAYORDER[] = L"psmbdf";
 
-#define b2s(bytes, off) ((bytes[off + 1] << 8) | bytes[off])
-#define b2i(bytes, off) ((bytes[off + 3] << 24) | (bytes[off + 2] << 16) | (bytes[off + 1] << 8) | bytes[off])
-static const int shof = 0x4c;
-static const unsigned char clsid[] = {0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46};
-static const int flocflg_ofof = 0x08;
-static const int bn_ofof = 0x10;
-static const int local_mask = 0x01;
-static const int remote_mask = 0x02;
+static const wchar_t* unit_suffix(int unit) {
+    if(unit == B)
+        return L"(B)";
+    if(unit == KB)
+        return L"(KB)";
+    if(unit == MB)
+        return L"(MB)";
+    if(unit == GB)
+        return L"(GB)";
+    return L"";
+}
 
 template <typename CharT, typename Traits = std::char_traits<CharT>>
 bool fnmatch(const CharT* txt, const CharT* pat) {
@@ -88,16 +114,56 @@ bool fnmatch(const std::filesystem::path& txt, const std::filesystem::path& pat)
     return fnmatch(txt.c_str(), pat.c_str());
 }
 
+/* Windows shortcut, by extension like Explorer does */
+bool is_shortcut(const fs::path& p) {
+    const auto& n = p.native();
+    return n.size() > 4 && n[n.size() - 4] == '.' && (n[n.size() - 3] | 32) == 'l' && (n[n.size() - 2] | 32) == 'n' &&
+           (n[n.size() - 1] | 32) == 'k';
+}
+
+/* shortcut target as print_symlink_target prints it, empty when p is not a readable shortcut */
+std::string shortcut_target(const fs::path& p) {
+    LnkTarget lnk;
+    if(!lnk.read(p))
+        return std::string();
+    std::string t(lnk.base, lnk.base_len);
+    if(lnk.suffix_len) {
+        if(lnk.network)
+            t += '\\';
+        t.append(lnk.suffix, lnk.suffix_len);
+    }
+    return t;
+}
+
 struct FileInfo {
     const fs::path f;
     struct _stat s;
+    std::string digest;
+    LnkDetails lnk;
+    bool lnk_resolved = false; /* lnk was filled in ahead, e.g. on a pool thread */
+    const wchar_t* target_state = L""; /* --check-targets */
+    int link = -1;      /* 1 symlink, 0 not, -1 not looked at yet */
+    fs::path link_path; /* symlink target for -l */
+    const wchar_t* file_type = NULL; /* t column, NULL until sniffed */
     FileInfo(const fs::path& _f) : f(_f) {
         _wstat(f.c_str(), &s);
     }
+    FileInfo(const fs::path& _f, const struct _stat& _s) : f(_f), s(_s) {}
+
+    /* s follows symlinks, so a symlink is told apart by the walk's d_type or, failing that, lstat */
+    bool is_symlink() {
+        if(link < 0) {
+            std::error_code ec;
+            link = fs::is_symlink(fs::symlink_status(f, ec)) ? 1 : 0;
+        }
+        return link == 1;
+    }
 
     void print_permission() {
         unsigned int m = s.st_mode;
-        if (_S_IFDIR & m)
+        if(is_symlink())
+            printf("%s", "LINK");
+        else if (_S_IFDIR & m)
             printf("%s", "DIR");
         else {
             auto ext = f.extension().wstring();
@@ -116,46 +182,35 @@ struct FileInfo {
     void print_dirname() { wprintf(L"%s", f.parent_path().c_str()); }
     void print_basename() { wprintf(L"%s", f.filename().c_str()); }
     void print_fullpath() { wprintf(L"%s", f.c_str()); }
-    void print_symlink_target() { 
-        unsigned char* buf = NULL;
-        fpos_t flen = 0;
-        FILE* fp = NULL;
-
-        if(_wfopen_s(&fp, f.c_str(), L"rb") == 0) {
-            if(fseek(fp, 0L, SEEK_END) == 0) {
-                if(fgetpos(fp, &flen) == 0) {
-                    if(fseek(fp, 0L, 0) == 0) {
-                        buf = new unsigned char[flen + 1];
-                        fread_s(buf, flen + 1, 1, flen, fp);
-                    }
-                }
-            }
-            fclose(fp);
-        }
-
-        if(buf == NULL)
+    void print_digest() { wprintf(L"%S", digest.c_str()); }
+    void print_file_type() {
+        if(file_type == NULL && (s.st_mode & _S_IFREG))
+            file_type = sniff_file(f);
+        wprintf(L"%s", file_type ? file_type : (s.st_mode & _S_IFREG) ? L"?" : L"");
+    }
+    void print_symlink_target() {
+        if(is_symlink()) {
+            std::error_code ec;
+            if(!lnk_resolved)
+                link_path = fs::read_symlink(f, ec);
+            wprintf(L"%s", link_path.c_str());
             return;
-
-        if(b2i(buf, 0) == shof && memcmp(buf + 4, clsid, sizeof(clsid)) == 0) {
-            int slen = b2s(buf, shof) + 2;
-            int lnkstart = shof + slen;
-            int floc_flg = b2i(buf, lnkstart + flocflg_ofof);
-            if(floc_flg & (local_mask | remote_mask)) {
-                if(floc_flg & local_mask) {
-                    int bn_of = b2i(buf, lnkstart + bn_ofof) + lnkstart;
-                    printf("%s", buf + bn_of);
-                } else {
-                    for(int i = flen - 5; i > 3; --i) {
-                        if(buf[i] == 0x00 && buf[i + 1] == 0x5C && buf[i + 2] == 0x00 && buf[i + 3] == 0x5C && buf[i + 4] == 0x00) {
-                            printf("%s", buf + i + 1);
-                            break;
-                        }
-                    }
-                }
-            }
         }
-        delete[] buf;
+        if(!lnk_resolved && is_shortcut(f))
+            lnk.target = shortcut_target(f);
+        printf("%s", lnk.target.c_str());
     }
+    /* the shortcut columns n, w, r, e. one parse fills all of them */
+    const LnkDetails& details() {
+        if(!lnk_resolved && is_shortcut(f))
+            LnkTarget().read_details(f, lnk);
+        lnk_resolved = true;
+        return lnk;
+    }
+    void print_lnk_network() { printf("%s", details().network.c_str()); }
+    void print_lnk_workdir() { wprintf(L"%s", details().working_dir.c_str()); }
+    void print_lnk_arguments() { wprintf(L"%s", details().arguments.c_str()); }
+    void print_lnk_description() { wprintf(L"%s", details().description.c_str()); }
     void print_dirs(const wchar_t* sep = DEFAULT_SEPARATOR) {
         const auto& ff = f.parent_path();
         const wchar_t* p = ff.c_str();
@@ -178,7 +233,7 @@ struct FileInfo {
         }
     }
 
-    void print_header(const wchar_t* display_order = DEFAULT_DISPLAYORDER, const wchar_t* sep = DEFAULT_SEPARATOR, int unit = KB, bool follow_symlink = false) {
+    void print_header(const wchar_t* display_order = DEFAULT_DISPLAYORDER, const wchar_t* sep = DEFAULT_SEPARATOR, int unit = KB, bool follow_symlink = false, bool check_targets = false) {
         const wchar_t* p = display_order;
         int i = 0;
         while(*p) {
@@ -196,33 +251,44 @@ struct FileInfo {
                 wprintf(L"%s", L"フルパス");
             else if(*p == 'g')
                 wprintf(L"%s", L"グループ名");
+            else if(*p == 'h')
+                wprintf(L"%s", L"ハッシュ");
             else if(*p == 'm')
                 wprintf(L"%s", L"更新日時");
             else if(*p == 'p')
                 wprintf(L"%s", L"種類");
             else if(*p == 's') {
                 wprintf(L"%s", L"サイズ");
-                if(unit == B)
-                    wprintf(L"%s", L"(B)");
-                else if(unit == KB)
-                    wprintf(L"%s", L"(KB)");
-                else if(unit == MB)
-                    wprintf(L"%s", L"(MB)");
-                else if(unit == GB)
-                    wprintf(L"%s", L"(GB)");
+                wprintf(L"%s", unit_suffix(unit));
             } else if(*p == 'u')
                 wprintf(L"%s", L"ユーザ名");
+            else if(*p == 'n')
+                wprintf(L"%s", L"ネットワーク共有");
+            else if(*p == 'w')
+                wprintf(L"%s", L"作業フォルダ");
+            else if(*p == 'r')
+                wprintf(L"%s", L"引数");
+            else if(*p == 'e')
+                wprintf(L"%s", L"説明");
+            else if(*p == 't')
+                wprintf(L"%s", L"内容種別");
             ++p, ++i;
         }
-        if(follow_symlink)
+        if(follow_symlink) {
+            wprintf(L"%s", sep);
             wprintf(L"%s", L"リンク先パス");
+        }
+        if(check_targets) {
+            wprintf(L"%s", sep);
+            wprintf(L"%s", L"リンク先状態");
+        }
 
         wprintf(L"%s", sep);
         wprintf(L"%s", L"DIRS");
         wprintf(L"%s", L"\n");
     }
 
-    void print_info(const wchar_t* display_order = DEFAULT_DISPLAYORDER, const wchar_t* sep = DEFAULT_SEPARATOR, const wchar_t* format = DATETIME_FORMAT, int unit = KB, bool follow_symlink = false) {
+    void print_info(const wchar_t* display_order = DEFAULT_DISPLAYORDER, const wchar_t* sep = DEFAULT_SEPARATOR, const wchar_t* format = DATETIME_FORMAT, int unit = KB, bool follow_symlink = false, bool check_targets = false) {
             const wchar_t* p = display_order;
             int i = 0;
             while(*p) {
@@ -240,6 +306,8 @@ struct FileInfo {
                     print_fullpath();
                 else if(*p == 'g')
                     print_groupname();
+                else if(*p == 'h')
+                    print_digest();
                 else if(*p == 'm')
                     print_mtime(format);
                 else if(*p == 'p')
@@ -248,19 +316,32 @@ struct FileInfo {
                     print_size(unit);
                 else if(*p == 'u')
                     print_username();
+                else if(*p == 'n')
+                    print_lnk_network();
+                else if(*p == 'w')
+                    print_lnk_workdir();
+                else if(*p == 'r')
+                    print_lnk_arguments();
+                else if(*p == 'e')
+                    print_lnk_description();
+                else if(*p == 't')
+                    print_file_type();
                 ++p, ++i;
             }
             if (follow_symlink){
                 wprintf(L"%s", sep);
                 print_symlink_target();
             }
+            if(check_targets) {
+                wprintf(L"%s", sep);
+                wprintf(L"%s", target_state);
+            }
             wprintf(L"%s", sep);
             print_dirs(sep);
             wprintf(L"\n");
     }
 
-    private:
-    int datetimestr(time_t t, const wchar_t* date_format = DATETIME_FORMAT) {
+    static int datetimestr(time_t t, const wchar_t* date_format = DATETIME_FORMAT) {
         struct tm tmp;
         if(localtime_s(&tmp, &t))
             return -1;
@@ -275,140 +356,3018 @@ struct FileInfo {
     }
 };
 
-int wmain(int argc, wchar_t* argv[]) {
-    setlocale(LC_ALL, "");
-    std::locale::global(std::locale(""));
+struct ReportOptions {
+    const wchar_t* display_order = DEFAULT_DISPLAYORDER;
+    const wchar_t* sep = DEFAULT_SEPARATOR;
+    const wchar_t* format = DATETIME_FORMAT;
+    int unit = KB;
+    int maxdepth = INT_MAX;
+    unsigned jobs = 0;
+    bool header = true;
+    bool follow_symlink = false;
+    bool dirs = false;
+};
 
-    auto ap = ArgParser(L"指定したフォルダのパスの下にあるファイル・ディレクトリの一覧出力するプログラムです.\n", argc, argv);
+struct ScanRoot {
+    fs::path pattern;
+    fs::path dir;
+    std::wstring match;
+    bool is_wildcard = false;
+    bool is_file = false;
+};
 
-    bool header = true;
-    ap.add(L"-n", L"--noheader", &header, L"ヘッダを出力しない\n");
+bool resolve_root(const wchar_t* a, ScanRoot& r) {
+    int len = 0, i = 0;
+    for(auto _ = a; *_; ++_) {
+        i += (*_ == '*' || *_ == '.' || *_ == '\\' || *_ == '/');
+        ++len;
+        r.is_wildcard = r.is_wildcard || (*_ == '*' || *_ == '?');
+    }
+    if(len == i)
+        r.is_wildcard = false;
 
-    bool disp_dirs = false;
-    ap.add(L"-D", L"--directory", &disp_dirs, L"ディレクトリの詳細情報を出力する(デフォルトは出力しない)\n");
+    r.pattern = fs::path(a);
+    if(fs::is_regular_file(r.pattern)) {
+        r.is_file = true;
+        return true;
+    }
+    r.dir = fs::is_directory(r.pattern) ? r.pattern : r.pattern.parent_path();
+    for(const wchar_t* c = r.pattern.c_str(), *s = r.pattern.c_str(); *c; ++c) {
+        if(*c == '?' || *c == '*') {
+            r.dir = fs::path(s, c).parent_path();
+            break;
+        }
+    }
+    if(fs::is_directory(r.dir) == false) {
+        std::wcerr << L"ファイルまたはディレクトリが存在しませんでした `" << a << L"` 正しいか確認してください" << std::endl;
+        return false;
+    }
+    r.match = r.pattern.generic_wstring();
+    return true;
+}
 
-    bool disp_files = true;
-    ap.add(L"-F", L"--file", &disp_files, L"ファイルの詳細情報を出力する(デフォルトは出力する)\n");
+bool match_root(const ScanRoot& r, const fs::path& p) {
+    return !r.is_wildcard || fnmatch(p.generic_wstring().c_str(), r.match.c_str());
+}
 
-    int maxdepth = INT_MAX;
-    ap.add(L"-x", L"--maxdepth", &maxdepth, L"再帰的に一覧表示する場合の最大何階層まで出力するかどうか (デフォルト無制限)\n");
+/* office lock files (~$xxx.docx) are never listed */
+bool is_lockfile(const fs::path& p) {
+    const auto& name = p.filename().native();
+    return name.size() > 1 && name[0] == '~' && name[1] == '$';
+}
 
-    wchar_t* sep = DEFAULT_SEPARATOR;
-    ap.add(L"-s", L"--sep", &sep, L"詳細情報の区切り文字、デフォルトはタブ文字\n");
+struct DirTotals {
+    std::atomic<uint64_t> size{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> dirs{0};
+    std::atomic<int64_t> newest{0};
 
-    bool follow_symlink = false;
-    ap.add(L"-l", L"--follow-symlink", &follow_symlink, L"リンク先パスを表示する。(注)少し処理が遅くなる");
+    void add(uint64_t _size, uint64_t _blocks, uint64_t _files, uint64_t _dirs, int64_t _mtime) {
+        size.fetch_add(_size, std::memory_order_relaxed);
+        blocks.fetch_add(_blocks, std::memory_order_relaxed);
+        files.fetch_add(_files, std::memory_order_relaxed);
+        dirs.fetch_add(_dirs, std::memory_order_relaxed);
+        int64_t cur = newest.load(std::memory_order_relaxed);
+        while(cur < _mtime && !newest.compare_exchange_weak(cur, _mtime, std::memory_order_relaxed)) {
+        }
+    }
+};
 
-    int unit = KB;
-    wchar_t u = 'k';
-    ap.add(L"-u", L"--sizeunit", &u, L"ファイルサイズの表示単位\n"
-                  L"                          b : バイト\n"
-                  L"                          k : キロバイト(デフォルト)\n"
-                  L"                          m : メガバイト\n"
-                  L"                          g : ギガバイト\n");
+struct DirRow {
+    fs::path path;
+    uint64_t size, blocks, files, dirs;
+    int64_t newest;
+};
 
-    wchar_t* display_order = DEFAULT_DISPLAYORDER;
-    ap.add(L"-d", L"--display", &display_order,
-                L"select display target categories. (default : display output all category)\n"
-                L"   p : permission       (ex. -rw-------)\n"
-                L"   u : owner user name  (ex. root)\n"
-                L"   g : owner group name (ex. root)\n"
-                L"   s : file size        (ex. 123456)\n"
-                L"   a : atime            (ex. 2022/02/05 10:00:00)\n"
-                L"   m : mtime            (ex. 2022/02/05 10:00:00)\n"
-                L"   c : ctime            (ex. 2022/02/05 10:00:00)\n"
-                L"   d : dirname          (ex. /root/.ssh)\n"
-                L"   b : filename          (ex. known_hosts)\n"
-                L"   f : fullpath         (ex. /root/.ssh/known_hosts)\n"
-                L"  Example: --display-category psmbdf\n"
-                L"  Output-> -rw-------  root root 123456 2022/02/05 10:00:00 /root/.ssh/known_hosts\n");
+/* du style per directory totals, summed bottom-up as each subtree completes */
+int print_aggregate(const std::vector<wchar_t*>& roots, const ReportOptions& opt) {
+    using Walker = DirWalker<DirTotals>;
 
-    wchar_t* format = DATETIME_FORMAT;
-    ap.add(L"-f", L"--format-time", &format,
-                L"output timeformat string. (default %Y/%m/%d_%H:%M:%S)\n"
-                L"see format definition.\n"
-                L"https://www.cplusplus.com/reference/ctime/strftime/\n");
-    ap.parse();
+    if(opt.header) {
+        wprintf(L"%s%s", L"フォルダパス", opt.sep);
+        wprintf(L"%s%s%s", L"サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s%s", L"割当サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s", L"ファイル数", opt.sep);
+        wprintf(L"%s%s", L"フォルダ数", opt.sep);
+        wprintf(L"%s\n", L"最終更新日時");
+    }
 
-    switch(u) {
-        case 'b':
-        case 'B':
-            unit = B;
-            break;
-        case 'k':
-        case 'K':
-            break;
-        case 'm':
-        case 'M':
-            unit = MB;
-            break;
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
+            return 1;
 
-        case 'g':
-        case 'G':
-            unit = GB;
-            break;
-        default:
-            std::wcerr << L"sizeunitの指定値が不明です。-hでヘルプを参照して正しい値を指定してください" << std::endl;
+        std::vector<DirRow> rows;
+        StatInfo rst;
+        if(r.is_file) {
+            if(stat_path(r.pattern, rst, true))
+                rows.push_back({r.pattern, rst.size, rst.blocks, 1, 0, rst.mtime});
+        } else {
+            Walker walker(opt.jobs);
+            walker.identity = true;
+            InodeSet links;
+            std::vector<std::vector<DirRow>> found(walker.threads());
+
+            walker.on_entry = [&](unsigned, const WalkEntry& e, Walker::Node& parent) {
+                if(e.st.is_dir && !e.st.is_link) {
+                    parent.data.add(0, e.st.blocks, 0, 1, e.st.mtime);
+                    return true;
+                }
+                /* a name the pattern excludes must not claim the inode before one it matches */
+                if(!match_root(r, e.path))
+                    return false;
+                if(e.st.nlink > 1 && !links.insert(e.st.dev, e.st.ino))
+                    return false;
+                parent.data.add(e.st.size, e.st.blocks, 1, 0, e.st.mtime);
+                return false;
+            };
+            walker.on_dir_done = [&](unsigned tid, Walker::Node& node) {
+                DirTotals& t = node.data;
+                if(node.depth < opt.maxdepth)
+                    found[tid].push_back({node.path, t.size, t.blocks, t.files, t.dirs, t.newest});
+                if(node.parent)
+                    node.parent->data.add(t.size, t.blocks, t.files, t.dirs, t.newest);
+            };
+
+            walker.add(r.dir);
+            walker.wait();
+            for(auto& f : found)
+                rows.insert(rows.end(), std::make_move_iterator(f.begin()), std::make_move_iterator(f.end()));
+            std::sort(rows.begin(), rows.end(), [](const DirRow& x, const DirRow& y) { return x.path < y.path; });
+
+            /* the root row also counts the root directory itself */
+            if(!rows.empty() && stat_path(r.dir, rst, true)) {
+                rows[0].blocks += rst.blocks;
+                rows[0].newest = (std::max)(rows[0].newest, rst.mtime);
+            }
+        }
+
+        for(auto& row : rows) {
+            wprintf(L"%s%s", row.path.c_str(), opt.sep);
+            wprintf(L"%llu%s", (unsigned long long)(row.size / opt.unit), opt.sep);
+            wprintf(L"%llu%s", (unsigned long long)(row.blocks / opt.unit), opt.sep);
+            wprintf(L"%llu%s", (unsigned long long)row.files, opt.sep);
+            wprintf(L"%llu%s", (unsigned long long)row.dirs, opt.sep);
+            FileInfo::datetimestr((time_t)row.newest, opt.format);
+            wprintf(L"\n");
+        }
+    }
+    return 0;
+}
+
+struct TopEntry {
+    int64_t score;
+    fs::path path;
+};
+
+/* N largest (size) or oldest (mtime, atime) files. each walker thread keeps its own bounded heap */
+int print_top(const std::vector<wchar_t*>& roots, const ReportOptions& opt, int topn, const wchar_t* by) {
+    int key = -1;
+    if(wcscmp(by, L"size") == 0)
+        key = 0;
+    else if(wcscmp(by, L"mtime") == 0)
+        key = 1;
+    else if(wcscmp(by, L"atime") == 0)
+        key = 2;
+    if(key < 0) {
+        std::wcerr << L"--byの指定値が不明です。size, mtime, atime のいずれかを指定してください" << std::endl;
+        return 1;
+    }
+
+    /* heap front is the weakest entry kept so far */
+    auto weaker = [](const TopEntry& x, const TopEntry& y) { return x.score > y.score; };
+    auto score_of = [key](const StatInfo& st) {
+        return key == 0 ? (int64_t)st.size : -(key == 1 ? st.mtime : st.atime);
+    };
+
+    std::vector<TopEntry> winners;
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
             return 1;
+        if(r.is_file) {
+            StatInfo st;
+            if(stat_path(r.pattern, st))
+                winners.push_back({score_of(st), r.pattern});
+            continue;
+        }
+
+        DirWalker<> walker(opt.jobs);
+        walker.maxdepth = opt.maxdepth;
+        std::vector<std::vector<TopEntry>> heaps(walker.threads());
+        for(auto& h : heaps)
+            h.reserve(topn);
+
+        walker.on_entry = [&](unsigned tid, const WalkEntry& e, DirWalker<>::Node&) {
+            if(e.st.is_dir)
+                return true;
+            auto& h = heaps[tid];
+            int64_t score = score_of(e.st);
+            if((int)h.size() == topn && score <= h.front().score)
+                return false;
+            if(is_lockfile(e.path) || !match_root(r, e.path))
+                return false;
+            if((int)h.size() == topn) {
+                std::pop_heap(h.begin(), h.end(), weaker);
+                h.pop_back();
+            }
+            h.push_back({score, e.path});
+            std::push_heap(h.begin(), h.end(), weaker);
+            return false;
+        };
+        walker.add(r.dir);
+        walker.wait();
+
+        for(auto& h : heaps)
+            winners.insert(winners.end(), std::make_move_iterator(h.begin()), std::make_move_iterator(h.end()));
     }
 
-    if(header) {
+    std::sort(winners.begin(), winners.end(), [](const TopEntry& x, const TopEntry& y) {
+        return x.score != y.score ? x.score > y.score : x.path < y.path;
+    });
+    if((int)winners.size() > topn)
+        winners.resize(topn);
+
+    if(opt.header) {
         FileInfo fp(".");
-        fp.print_header(display_order, sep, unit, follow_symlink);
+        fp.print_header(opt.display_order, opt.sep, opt.unit, opt.follow_symlink);
+    }
+    for(auto& w : winners) {
+        FileInfo fp(w.path);
+        fp.print_info(opt.display_order, opt.sep, opt.format, opt.unit, opt.follow_symlink);
     }
+    return 0;
+}
 
-    if(ap.positional_argv.size() == 0)
-        ap.positional_argv.push_back(L".");
+using PathString = fs::path::string_type;
+
+/* seconds per duration unit h, d, w, m (30d), y (365d). 0 for anything else */
+static int64_t duration_unit(wchar_t c) {
+    switch(c) {
+        case L'h': return 3600;
+        case L'd': return 86400;
+        case L'w': return 86400 * 7;
+        case L'm': return 86400 * 30;
+        case L'y': return 86400 * 365;
+    }
+    return 0;
+}
+
+/* a single duration like 12h or 7d */
+bool parse_duration(const wchar_t* s, int64_t& sec) {
+    int64_t n = 0;
+    const wchar_t* p = s;
+    while(*p >= L'0' && *p <= L'9')
+        n = n * 10 + (*p++ - L'0');
+    int64_t scale = duration_unit(*p);
+    if(p == s || scale == 0 || p[1] != 0)
+        return false;
+    sec = n * scale;
+    return true;
+}
+
+/* age ranges used by --group-by age-bucket and --histogram. limits are in seconds, ascending */
+struct AgeBuckets {
+    static const std::size_t MAX_AGE_BUCKETS = 63;
+    std::vector<int64_t> limits;
+    std::vector<PathString> labels;
+
+    AgeBuckets() { parse(L"1d,7d,30d,1y"); }
+
+    /* spec is a comma separated list like 1d,7d,30d,1y (units h, d, w, m=30d, y=365d) */
+    bool parse(const wchar_t* spec) {
+        std::vector<int64_t> lim;
+        std::vector<std::wstring> names;
+        for(const wchar_t* p = spec; *p;) {
+            const wchar_t* start = p;
+            int64_t n = 0;
+            while(*p >= L'0' && *p <= L'9')
+                n = n * 10 + (*p++ - L'0');
+            int64_t scale = duration_unit(*p);
+            if(p == start || scale == 0 || (!lim.empty() && n * scale <= lim.back()) || lim.size() == MAX_AGE_BUCKETS)
+                return false;
+            lim.push_back(n * scale);
+            names.emplace_back(start, ++p);
+            if(*p == L',')
+                ++p;
+        }
+        if(lim.empty())
+            return false;
+        limits = lim;
+        labels.clear();
+        for(std::size_t i = 0; i <= lim.size(); ++i) {
+            std::wstring l = (i == 0 ? L"" : names[i - 1]) + L"~" + (i < lim.size() ? names[i] : L"");
+            labels.push_back(fs::path(l).native());
+        }
+        return true;
+    }
+
+    std::size_t index(int64_t age) const {
+        std::size_t i = 0;
+        while(i < limits.size() && age >= limits[i])
+            ++i;
+        return i;
+    }
+};
+
+struct GroupStats {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    int64_t oldest = INT64_MAX;
+    int64_t newest = INT64_MIN;
+    std::size_t order = 0;
+
+    void add(const StatInfo& st) {
+        ++count;
+        sum += st.size;
+        min = (std::min)(min, st.size);
+        max = (std::max)(max, st.size);
+        oldest = (std::min)(oldest, st.mtime);
+        newest = (std::max)(newest, st.mtime);
+    }
+    void merge(const GroupStats& o) {
+        count += o.count;
+        sum += o.sum;
+        min = (std::min)(min, o.min);
+        max = (std::max)(max, o.max);
+        oldest = (std::min)(oldest, o.oldest);
+        newest = (std::max)(newest, o.newest);
+        order = o.order;
+    }
+};
+
+using GroupTable = OpenHashMap<PathString, GroupStats>;
+
+template <typename CharT>
+void append_number(std::basic_string<CharT>& s, uint64_t n) {
+    CharT buf[24];
+    int i = 24;
+    do {
+        buf[--i] = (CharT)('0' + n % 10);
+        n /= 10;
+    } while(n);
+    s.append(buf + i, 24 - i);
+}
+
+/* --group-by ext|uid|gid|depthN|age-bucket|type. rows are folded into per-thread tables, never materialized */
+int print_group_by(const std::vector<wchar_t*>& roots, const ReportOptions& opt, const wchar_t* by, const AgeBuckets& ages) {
+    enum { EXT, UID, GID, DEPTH, AGE, TYPE } kind;
+    int depthn = 0;
+    if(wcscmp(by, L"ext") == 0)
+        kind = EXT;
+    else if(wcscmp(by, L"uid") == 0)
+        kind = UID;
+    else if(wcscmp(by, L"gid") == 0)
+        kind = GID;
+    else if(wcscmp(by, L"age-bucket") == 0)
+        kind = AGE;
+    else if(wcscmp(by, L"type") == 0)
+        kind = TYPE;
+    else if(wcsncmp(by, L"depth", 5) == 0 && (depthn = (int)wcstol(by + 5, NULL, 10)) > 0)
+        kind = DEPTH;
+    else {
+        std::wcerr << L"--group-byの指定値が不明です。-hでヘルプを参照して正しい値を指定してください" << std::endl;
+        return 1;
+    }
+
+    const PathString none = fs::path(L"(なし)").native();
+    const PathString type_names[] = {fs::path(L"DIR").native(), fs::path(L"LINK").native(), fs::path(L"FILE").native()};
+    const int64_t now = (int64_t)time(NULL);
+
+    GroupTable result;
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
+            return 1;
+        const PathString& rn = r.dir.native();
+        const std::size_t root_len = rn.size() - (!rn.empty() && (rn.back() == '/' || rn.back() == '\\'));
+
+        DirWalker<> walker(opt.jobs);
+        walker.maxdepth = opt.maxdepth;
+        std::vector<GroupTable> tables(walker.threads());
+        std::vector<PathString> keys(walker.threads());
+
+        auto fold = [&](unsigned tid, const fs::path& p, const StatInfo& st) {
+            PathString& key = keys[tid];
+            key.clear();
+            std::size_t order = 0;
+            switch(kind) {
+                case EXT: {
+                    const PathString& n = p.native();
+                    std::size_t dot = n.find_last_of('.');
+                    std::size_t sep = n.find_last_of(fs::path::preferred_separator);
+                    if(dot == PathString::npos || (sep != PathString::npos && dot < sep) || dot + 1 == n.size())
+                        key = none;
+                    for(std::size_t i = dot + 1; key.empty() && i < n.size(); ++i)
+                        key.push_back((n[i] >= 'A' && n[i] <= 'Z') ? n[i] + 32 : n[i]);
+                    break;
+                }
+                case UID:
+                    append_number(key, st.uid);
+                    break;
+                case GID:
+                    append_number(key, st.gid);
+                    break;
+                case DEPTH: {
+                    const PathString& n = p.native();
+                    std::size_t b = (std::min)(root_len + 1, n.size()), e = b;
+                    for(int d = 0; d < depthn; ++d) {
+                        std::size_t next = n.find_first_of(fs::path::preferred_separator, e == b ? b : e + 1);
+                        if(next == PathString::npos)
+                            break;
+                        e = next;
+                    }
+                    if(e == b)
+                        key.push_back('.');
+                    else
+                        key.assign(n, b, e - b);
+                    break;
+                }
+                case AGE:
+                    order = ages.index(now - st.mtime);
+                    key = ages.labels[order];
+                    break;
+                case TYPE: {
+                    key = type_names[st.is_dir ? 0 : (st.is_link || is_shortcut(p)) ? 1 : 2];
+                    break;
+                }
+            }
+            GroupStats& g = tables[tid][key];
+            g.order = order;
+            g.add(st);
+        };
+
+        if(r.is_file) {
+            StatInfo st;
+            if(stat_path(r.pattern, st))
+                fold(0, r.pattern, st);
+        } else {
+            walker.on_entry = [&](unsigned tid, const WalkEntry& e, DirWalker<>::Node&) {
+                if(e.st.is_dir && !opt.dirs)
+                    return true;
+                if(!is_lockfile(e.path) && match_root(r, e.path))
+                    fold(tid, e.path, e.st);
+                return e.st.is_dir;
+            };
+            walker.add(r.dir);
+            walker.wait();
+        }
+        for(auto& t : tables)
+            result.merge(t, [](GroupStats& into, const GroupStats& from) { into.merge(from); });
+    }
+
+    std::vector<std::pair<PathString, GroupStats>> rows;
+    rows.reserve(result.size());
+    result.for_each([&](const PathString& k, GroupStats& g) { rows.emplace_back(k, g); });
+    std::sort(rows.begin(), rows.end(), [](const auto& x, const auto& y) {
+        return x.second.order != y.second.order ? x.second.order < y.second.order : x.first < y.first;
+    });
+
+    if(opt.header) {
+        wprintf(L"%s%s", L"グループ", opt.sep);
+        wprintf(L"%s%s", L"件数", opt.sep);
+        wprintf(L"%s%s%s", L"合計サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s%s", L"最小サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s%s", L"最大サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s", L"最古更新日時", opt.sep);
+        wprintf(L"%s\n", L"最新更新日時");
+    }
+    for(auto& row : rows) {
+        const GroupStats& g = row.second;
+        wprintf(L"%s%s", row.first.c_str(), opt.sep);
+        wprintf(L"%llu%s", (unsigned long long)g.count, opt.sep);
+        wprintf(L"%llu%s", (unsigned long long)(g.sum / opt.unit), opt.sep);
+        wprintf(L"%llu%s", (unsigned long long)(g.min / opt.unit), opt.sep);
+        wprintf(L"%llu%s", (unsigned long long)(g.max / opt.unit), opt.sep);
+        FileInfo::datetimestr((time_t)g.oldest, opt.format);
+        wprintf(L"%s", opt.sep);
+        FileInfo::datetimestr((time_t)g.newest, opt.format);
+        wprintf(L"\n");
+    }
+    return 0;
+}
+
+struct alignas(64) Histogram {
+    static const int BUCKETS = 65;
+    uint64_t count[BUCKETS] = {0};
+    uint64_t bytes[BUCKETS] = {0};
+
+    void merge(const Histogram& o) {
+        for(int i = 0; i < BUCKETS; ++i) {
+            count[i] += o.count[i];
+            bytes[i] += o.bytes[i];
+        }
+    }
+};
+
+/* 0 for empty files, otherwise k where 2^(k-1) <= size < 2^k */
+inline int log2_bucket(uint64_t size) {
+    int k = 0;
+    while(size) {
+        size >>= 1;
+        ++k;
+    }
+    return k;
+}
+
+static void print_bytes_label(uint64_t n) {
+    static const wchar_t* units[] = {L"B", L"KB", L"MB", L"GB", L"TB", L"PB", L"EB"};
+    int i = 0;
+    while(n >= 1024 && n % 1024 == 0 && i < 6) {
+        n /= 1024;
+        ++i;
+    }
+    wprintf(L"%llu%s", (unsigned long long)n, units[i]);
+}
+
+/* --histogram size|mtime|atime. each file costs one counter increment in a per-thread array */
+int print_histogram(const std::vector<wchar_t*>& roots, const ReportOptions& opt, const wchar_t* by, const AgeBuckets& ages, bool bar) {
+    int key = -1;
+    if(wcscmp(by, L"size") == 0)
+        key = 0;
+    else if(wcscmp(by, L"mtime") == 0)
+        key = 1;
+    else if(wcscmp(by, L"atime") == 0)
+        key = 2;
+    if(key < 0) {
+        std::wcerr << L"--histogramの指定値が不明です。size, mtime, atime のいずれかを指定してください" << std::endl;
+        return 1;
+    }
+    const int64_t now = (int64_t)time(NULL);
+    auto bucket_of = [&](const StatInfo& st) {
+        if(key == 0)
+            return log2_bucket(st.size);
+        int64_t age = now - (key == 1 ? st.mtime : st.atime);
+        return (int)ages.index(age < 0 ? 0 : age);
+    };
 
-    for(auto a : ap.positional_argv) {
-        bool is_wildcard = false;
-        int len = 0, i = 0;
-        for(auto _ = a; *_; ++_) {
-            i += (*_ == '*' || *_ == '.' || *_ == '\\' || *_ == '/');
-            ++len;
-            is_wildcard = is_wildcard || (*_ == '*' || *_ == '?');
-        }
-        if(len == i)
-            is_wildcard = false;
-
-        fs::path pth(a);
-        if(fs::is_regular_file(pth)) {
-            FileInfo fp(pth);
-            fp.print_info(display_order, sep, format, unit, follow_symlink);
+    Histogram total;
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
+            return 1;
+        if(r.is_file) {
+            StatInfo st;
+            if(stat_path(r.pattern, st)) {
+                int b = bucket_of(st);
+                total.count[b] += 1;
+                total.bytes[b] += st.size;
+            }
             continue;
         }
-        fs::path d = fs::is_directory(pth) ? pth: pth.parent_path();
-        for(const wchar_t* c = pth.c_str(), *s = pth.c_str(); *c; ++c) {
-            if(*c == '?' || *c == '*'){
-                d = fs::path(s, c).parent_path();
-                break;
+
+        DirWalker<> walker(opt.jobs);
+        walker.maxdepth = opt.maxdepth;
+        std::vector<Histogram> hists(walker.threads());
+        walker.on_entry = [&](unsigned tid, const WalkEntry& e, DirWalker<>::Node&) {
+            if(e.st.is_dir)
+                return true;
+            if(!is_lockfile(e.path) && match_root(r, e.path)) {
+                int b = bucket_of(e.st);
+                hists[tid].count[b] += 1;
+                hists[tid].bytes[b] += e.st.size;
+            }
+            return false;
+        };
+        walker.add(r.dir);
+        walker.wait();
+        for(auto& h : hists)
+            total.merge(h);
+    }
+
+    int first = 0, last = key == 0 ? Histogram::BUCKETS - 1 : (int)ages.limits.size();
+    if(key == 0) {
+        while(first < last && total.count[first] == 0)
+            ++first;
+        while(last > first && total.count[last] == 0)
+            --last;
+    }
+    uint64_t files = 0, peak = 0;
+    for(int i = first; i <= last; ++i) {
+        files += total.count[i];
+        peak = (std::max)(peak, total.count[i]);
+    }
+
+    if(opt.header) {
+        wprintf(L"%s%s", L"区間", opt.sep);
+        wprintf(L"%s%s", key == 0 ? L"下限(B)" : L"下限(秒)", opt.sep);
+        wprintf(L"%s%s", key == 0 ? L"上限(B)" : L"上限(秒)", opt.sep);
+        wprintf(L"%s%s", L"件数", opt.sep);
+        wprintf(L"%s%s%s", L"合計サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s", L"割合(%)");
+        if(bar)
+            wprintf(L"%s%s", opt.sep, L"グラフ");
+        wprintf(L"\n");
+    }
+    for(int i = first; i <= last; ++i) {
+        if(key == 0) {
+            uint64_t lo = i == 0 ? 0 : 1ULL << (i - 1), hi = i == 0 ? 0 : (i == 64 ? UINT64_MAX : (1ULL << i) - 1);
+            if(i == 0)
+                wprintf(L"0B");
+            else {
+                print_bytes_label(lo);
+                wprintf(L"~");
+                if(i < 64)
+                    print_bytes_label(hi + 1);
             }
+            wprintf(L"%s%llu%s%llu%s", opt.sep, (unsigned long long)lo, opt.sep, (unsigned long long)hi, opt.sep);
+        } else {
+            std::size_t n = ages.limits.size();
+            long long lo = i == 0 ? 0 : (long long)ages.limits[i - 1];
+            wprintf(L"%s%s%lld%s", ages.labels[i].c_str(), opt.sep, lo, opt.sep);
+            if((std::size_t)i < n)
+                wprintf(L"%lld", (long long)ages.limits[i] - 1);
+            wprintf(L"%s", opt.sep);
         }
-        if(fs::is_directory(d) == false){
-            std::wcerr << L"ファイルまたはディレクトリが存在しませんでした `" << a << L"` 正しいか確認してください" << std::endl;
+        wprintf(L"%llu%s", (unsigned long long)total.count[i], opt.sep);
+        wprintf(L"%llu%s", (unsigned long long)(total.bytes[i] / opt.unit), opt.sep);
+        wprintf(L"%.2f", files ? 100.0 * total.count[i] / files : 0.0);
+        if(bar) {
+            wprintf(L"%s", opt.sep);
+            for(uint64_t j = 0, w = peak ? (total.count[i] * 50 + peak - 1) / peak : 0; j < w; ++j)
+                wprintf(L"*");
+        }
+        wprintf(L"\n");
+    }
+    return 0;
+}
+
+struct DupCandidate {
+    fs::path path;
+    uint64_t size;
+    unsigned char partial[Murmur3::DIGEST_SIZE];
+    unsigned char full[Murmur3::DIGEST_SIZE];
+    bool ok;
+};
+
+static const uint64_t DUP_PARTIAL = 64 * 1024;
+
+/* hash of the first and last 64KiB. files up to 128KiB are hashed whole, so this is already the full hash */
+bool partial_hash(DupCandidate& c, std::vector<unsigned char>& buf) {
+    FileReader f(c.path);
+    if(!f.is_open() || f.size() != c.size)
+        return false;
+    Murmur3 h;
+    if(c.size <= 2 * DUP_PARTIAL) {
+        if(!f.hash_range(h, 0, c.size, buf))
+            return false;
+    } else if(!f.hash_range(h, 0, DUP_PARTIAL, buf) || !f.hash_range(h, c.size - DUP_PARTIAL, DUP_PARTIAL, buf))
+        return false;
+    h.finish(c.partial);
+    memcpy(c.full, c.partial, sizeof(c.full));
+    return true;
+}
+
+bool full_hash(DupCandidate& c, std::vector<unsigned char>& buf) {
+    FileReader f(c.path);
+    if(!f.is_open() || f.size() != c.size)
+        return false;
+    Murmur3 h;
+    if(!f.hash_range(h, 0, c.size, buf))
+        return false;
+    h.finish(c.full);
+    return true;
+}
+
+/*
+ * --duplicates. files are bucketed by size while walking; only size collisions get a partial hash,
+ * and only partial hash collisions are read in full. hard links of one file are counted once.
+ */
+int print_duplicates(const std::vector<wchar_t*>& roots, const ReportOptions& opt) {
+    using SizeBuckets = std::unordered_map<uint64_t, std::vector<fs::path>>;
+    SizeBuckets by_size;
+    InodeSet links;
+
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
             return 1;
+        if(r.is_file) {
+            StatInfo st;
+            if(stat_path(r.pattern, st, true) && st.size && (st.nlink < 2 || links.insert(st.dev, st.ino)))
+                by_size[st.size].push_back(r.pattern);
+            continue;
         }
-        for(auto entry = fs::recursive_directory_iterator(d, fs::directory_options::skip_permission_denied),
-                 last = fs::recursive_directory_iterator();
-            entry != last; ++entry) {
-            if(entry->is_directory()) {
-                if(entry.depth() > maxdepth)
-                    break;
-                if(!disp_dirs)
-                    continue;
+
+        DirWalker<> walker(opt.jobs);
+        walker.maxdepth = opt.maxdepth;
+        walker.identity = true;
+        std::vector<SizeBuckets> buckets(walker.threads());
+        walker.on_entry = [&](unsigned tid, const WalkEntry& e, DirWalker<>::Node&) {
+            if(e.st.is_dir)
+                return true;
+            if(e.st.size == 0 || e.st.is_link || is_lockfile(e.path) || !match_root(r, e.path))
+                return false;
+            if(e.st.nlink > 1 && !links.insert(e.st.dev, e.st.ino))
+                return false;
+            buckets[tid][e.st.size].push_back(e.path);
+            return false;
+        };
+        walker.add(r.dir);
+        walker.wait();
+
+        for(auto& b : buckets) {
+            for(auto& kv : b) {
+                auto& dst = by_size[kv.first];
+                dst.insert(dst.end(), std::make_move_iterator(kv.second.begin()), std::make_move_iterator(kv.second.end()));
             }
-            auto epth = entry->path();
-            auto ep = epth.filename().c_str();
+        }
+    }
 
-            if(ep[0] == L'~' && ep[1] == L'$')
-                continue;
+    std::vector<DupCandidate> cands;
+    for(auto& kv : by_size) {
+        if(kv.second.size() < 2)
+            continue;
+        for(auto& p : kv.second)
+            cands.push_back({std::move(p), kv.first, {0}, {0}, false});
+    }
+    by_size.clear();
 
-            if(is_wildcard && fnmatch(epth.generic_wstring().c_str(), pth.generic_wstring().c_str()) == false)
-                continue;
+    TaskPool pool(opt.jobs);
+    std::vector<std::vector<unsigned char>> bufs(pool.size());
+    for(auto& c : cands) {
+        DupCandidate* cp = &c;
+        pool.submit([cp, &bufs](unsigned tid) { cp->ok = partial_hash(*cp, bufs[tid]); });
+    }
+    pool.wait();
 
-            FileInfo fp(epth);
-            fp.print_info(display_order, sep, format, unit, follow_symlink);
+    auto by_partial = [](const DupCandidate& x, const DupCandidate& y) {
+        if(x.ok != y.ok)
+            return x.ok;
+        if(x.size != y.size)
+            return x.size > y.size;
+        int c = memcmp(x.partial, y.partial, sizeof(x.partial));
+        return c != 0 ? c < 0 : x.path < y.path;
+    };
+    std::sort(cands.begin(), cands.end(), by_partial);
+    for(std::size_t i = 0, j; i < cands.size() && cands[i].ok; i = j) {
+        for(j = i + 1; j < cands.size() && cands[j].ok && cands[j].size == cands[i].size &&
+                       memcmp(cands[j].partial, cands[i].partial, sizeof(cands[i].partial)) == 0;
+            ++j) {
+        }
+        if(j - i < 2 || cands[i].size <= 2 * DUP_PARTIAL)
+            continue;
+        for(std::size_t k = i; k < j; ++k) {
+            DupCandidate* cp = &cands[k];
+            pool.submit([cp, &bufs](unsigned tid) { cp->ok = full_hash(*cp, bufs[tid]); });
+        }
+    }
+    pool.wait();
+
+    std::sort(cands.begin(), cands.end(), [](const DupCandidate& x, const DupCandidate& y) {
+        if(x.ok != y.ok)
+            return x.ok;
+        if(x.size != y.size)
+            return x.size > y.size;
+        int c = memcmp(x.full, y.full, sizeof(x.full));
+        return c != 0 ? c < 0 : x.path < y.path;
+    });
+
+    if(opt.header) {
+        wprintf(L"%s%s", L"グループ", opt.sep);
+        wprintf(L"%s%s%s", L"サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s", L"ハッシュ", opt.sep);
+        wprintf(L"%s\n", L"フルパス");
+    }
+    unsigned long long group = 0;
+    for(std::size_t i = 0, j; i < cands.size() && cands[i].ok; i = j) {
+        for(j = i + 1; j < cands.size() && cands[j].ok && cands[j].size == cands[i].size &&
+                       memcmp(cands[j].full, cands[i].full, sizeof(cands[i].full)) == 0;
+            ++j) {
+        }
+        if(j - i < 2)
+            continue;
+        ++group;
+        std::string hex = to_hex(cands[i].full, sizeof(cands[i].full));
+        for(std::size_t k = i; k < j; ++k) {
+            wprintf(L"%llu%s", group, opt.sep);
+            wprintf(L"%llu%s", (unsigned long long)(cands[k].size / opt.unit), opt.sep);
+            wprintf(L"%S%s", hex.c_str(), opt.sep);
+            wprintf(L"%s\n", cands[k].path.c_str());
+        }
+    }
+    return 0;
+}
+
+struct MerkleEntry {
+    PathString name;
+    uint64_t size;
+    int64_t mtime;
+    char type; /* f: file, l: symlink, d: directory (child directories only carry hash) */
+    unsigned char hash[Murmur3::DIGEST_SIZE]; /* content hash of files, tree hash of directories */
+};
+
+/* MerkleRow::flags. an unreadable directory or file must never look like an empty or unchanged one */
+static const unsigned char MERKLE_FAILED = 1; /* the directory, or a file read for --merkle-content, failed */
+static const unsigned char MERKLE_BROKEN = 2; /* FAILED here or anywhere below */
+
+struct MerkleDir {
+    std::vector<MerkleEntry> files; /* filled by the one thread listing the directory */
+    std::vector<MerkleEntry> dirs;  /* filled by the children as they complete */
+    unsigned char flags = 0;        /* FAILED by the listing thread, BROKEN also by the children */
+    std::mutex mtx;
+};
+
+/* files: hash of the directory's own entries. tree: files plus every child directory's tree hash */
+struct MerkleRow {
+    PathString path; /* relative to the root, "." for the root itself */
+    unsigned char files[Murmur3::DIGEST_SIZE];
+    unsigned char tree[Murmur3::DIGEST_SIZE];
+    unsigned char flags;
+};
+
+/*
+ * A merkle file is the magic and then one record per directory, the root first. The records of
+ * a directory's children follow each other and are sorted by name, and each record points at its
+ * children, so a comparison seeks to the children of the directories that differ and reads
+ * nothing else.
+ *   u32 name length, name (path units), files, tree, u8 flags, u32 children, u64 offset, u64 bytes
+ */
+static const char MERKLE_MAGIC[8] = {'L', 'S', 'D', 'M', 'R', 'K', 'L', '2'};
+
+struct MerkleNode {
+    PathString name;
+    unsigned char files[Murmur3::DIGEST_SIZE];
+    unsigned char tree[Murmur3::DIGEST_SIZE];
+    unsigned char flags;
+    uint32_t kids;
+    uint64_t kids_off;
+    uint64_t kids_bytes;
+};
+
+static const std::size_t MERKLE_FIXED = 2 * Murmur3::DIGEST_SIZE + 1 + 4 + 8 + 8;
+
+static void merkle_feed(Murmur3& h, const MerkleEntry& e, bool with_meta) {
+    uint32_t len = (uint32_t)e.name.size();
+    h.update(&len, sizeof(len));
+    h.update(e.name.data(), len * sizeof(e.name[0]));
+    h.update(&e.type, 1);
+    if(with_meta) {
+        h.update(&e.size, sizeof(e.size));
+        h.update(&e.mtime, sizeof(e.mtime));
+    }
+    h.update(e.hash, sizeof(e.hash));
+}
+
+/* hashes one root bottom-up: each directory once all of its subdirectories are done */
+bool merkle_scan(const fs::path& root, const ReportOptions& opt, bool content, std::vector<MerkleRow>& rows) {
+    using Walker = DirWalker<MerkleDir>;
+    Walker walker(opt.jobs);
+    std::vector<std::vector<MerkleRow>> found(walker.threads());
+    std::vector<std::vector<unsigned char>> bufs(walker.threads());
+    std::size_t root_len = root.native().size();
+
+    walker.on_entry = [&](unsigned tid, const WalkEntry& e, Walker::Node& parent) {
+        if(e.st.is_dir && !e.st.is_link)
+            return true;
+        if(is_lockfile(e.path))
+            return false;
+        MerkleEntry m = {e.path.filename().native(), e.st.size, e.st.mtime, e.st.is_link ? 'l' : 'f', {0}};
+        if(content && !e.st.is_link && !e.st.is_dir) {
+            FileReader f(e.path);
+            Murmur3 h;
+            if(f.is_open() && f.hash_range(h, 0, f.size(), bufs[tid]))
+                h.finish(m.hash);
+            else
+                parent.data.flags |= MERKLE_FAILED | MERKLE_BROKEN;
+        }
+        parent.data.files.push_back(std::move(m));
+        return false;
+    };
+    walker.on_dir_done = [&](unsigned tid, Walker::Node& node) {
+        MerkleDir& d = node.data;
+        auto by_name = [](const MerkleEntry& x, const MerkleEntry& y) { return x.name < y.name; };
+        std::sort(d.files.begin(), d.files.end(), by_name);
+        std::sort(d.dirs.begin(), d.dirs.end(), by_name);
+
+        MerkleRow row;
+        Murmur3 fh;
+        for(auto& e : d.files)
+            merkle_feed(fh, e, true);
+        fh.finish(row.files);
+        Murmur3 th;
+        th.update(row.files, sizeof(row.files));
+        for(auto& e : d.dirs)
+            merkle_feed(th, e, false);
+        th.finish(row.tree);
+        row.flags = d.flags | (node.unreadable ? MERKLE_FAILED | MERKLE_BROKEN : 0);
+
+        const PathString& p = node.path.native();
+        std::size_t skip = root_len + (p.size() > root_len && (p[root_len] == '/' || p[root_len] == '\\') ? 1 : 0);
+        row.path = p.size() > root_len ? p.substr(skip) : fs::path(L".").native();
+        if(node.parent) {
+            MerkleEntry up = {node.path.filename().native(), 0, 0, 'd', {0}};
+            memcpy(up.hash, row.tree, sizeof(up.hash));
+            std::lock_guard<std::mutex> lk(node.parent->data.mtx);
+            node.parent->data.dirs.push_back(std::move(up));
+            node.parent->data.flags |= row.flags & MERKLE_BROKEN;
+        }
+        found[tid].push_back(std::move(row));
+        d.files.clear();
+        d.dirs.clear();
+    };
+    walker.add(root);
+    walker.wait();
+
+    rows.clear();
+    for(auto& f : found)
+        rows.insert(rows.end(), std::make_move_iterator(f.begin()), std::make_move_iterator(f.end()));
+    return !rows.empty();
+}
+
+/* lays the scanned rows out as a merkle file, magic included */
+std::string merkle_encode(const std::vector<MerkleRow>& rows) {
+    const PathString dot = fs::path(L".").native();
+    std::unordered_map<PathString, std::size_t> at;
+    for(std::size_t i = 0; i < rows.size(); ++i)
+        at[rows[i].path] = i;
+    std::vector<std::vector<std::size_t>> kids(rows.size());
+    std::vector<PathString> names(rows.size());
+    std::size_t root = rows.size();
+    for(std::size_t i = 0; i < rows.size(); ++i) {
+        if(rows[i].path == dot) {
+            root = i;
+            names[i] = dot;
+            continue;
+        }
+        fs::path p(rows[i].path);
+        names[i] = p.filename().native();
+        auto parent = at.find(p.has_parent_path() ? p.parent_path().native() : dot);
+        if(parent != at.end())
+            kids[parent->second].push_back(i);
+    }
+    if(root == rows.size())
+        return std::string();
+
+    /* breadth first, so every directory's children are one run of records */
+    std::vector<std::size_t> order = {root};
+    for(std::size_t k = 0; k < order.size(); ++k) {
+        auto& v = kids[order[k]];
+        std::sort(v.begin(), v.end(), [&](std::size_t x, std::size_t y) { return names[x] < names[y]; });
+        order.insert(order.end(), v.begin(), v.end());
+    }
+    auto bytes = [&](std::size_t i) { return 4 + names[i].size() * sizeof(PathString::value_type) + MERKLE_FIXED; };
+    std::vector<uint64_t> off(rows.size());
+    uint64_t pos = sizeof(MERKLE_MAGIC);
+    for(std::size_t i : order) {
+        off[i] = pos;
+        pos += bytes(i);
+    }
+
+    std::string out(MERKLE_MAGIC, sizeof(MERKLE_MAGIC));
+    out.reserve((std::size_t)pos);
+    auto put = [&out](const void* p, std::size_t n) { out.append((const char*)p, n); };
+    for(std::size_t i : order) {
+        const MerkleRow& r = rows[i];
+        uint32_t len = (uint32_t)names[i].size(), n = (uint32_t)kids[i].size();
+        uint64_t first = n ? off[kids[i][0]] : 0, span = 0;
+        for(std::size_t k : kids[i])
+            span += bytes(k);
+        put(&len, sizeof(len));
+        put(names[i].data(), len * sizeof(PathString::value_type));
+        put(r.files, sizeof(r.files));
+        put(r.tree, sizeof(r.tree));
+        put(&r.flags, 1);
+        put(&n, sizeof(n));
+        put(&first, sizeof(first));
+        put(&span, sizeof(span));
+    }
+    return out;
+}
+
+bool merkle_save(const fs::path& p, const std::string& image) {
+    fs::path tmp = p.native() + fs::path(L".tmp").native();
+    FILE* fp = open_binary(tmp, true);
+    if(fp == NULL)
+        return false;
+    bool ok = fwrite(image.data(), 1, image.size(), fp) == image.size();
+    ok = fclose(fp) == 0 && ok;
+    std::error_code ec;
+    if(ok)
+        fs::rename(tmp, p, ec);
+    if(!ok || ec)
+        fs::remove(tmp, ec);
+    return ok && !ec;
+}
+
+/* records of a merkle file, read on demand from the file or from an image in memory */
+class MerkleReader {
+   public:
+    /* false when p is not a merkle file */
+    bool open(const fs::path& p) {
+        file.reset(new FileReader(p));
+        size = file->size();
+        char magic[sizeof(MERKLE_MAGIC)];
+        return file->is_open() && read(0, magic, sizeof(magic)) && memcmp(magic, MERKLE_MAGIC, sizeof(magic)) == 0;
+    }
+
+    bool assign(std::string img) {
+        file.reset();
+        image = std::move(img);
+        size = image.size();
+        return size >= sizeof(MERKLE_MAGIC) && memcmp(image.data(), MERKLE_MAGIC, sizeof(MERKLE_MAGIC)) == 0;
+    }
+
+    bool root(MerkleNode& n) {
+        uint32_t len = 0;
+        if(!read(sizeof(MERKLE_MAGIC), &len, sizeof(len)))
+            return false;
+        uint64_t bytes = 4 + (uint64_t)len * sizeof(PathString::value_type) + MERKLE_FIXED;
+        std::string buf;
+        std::vector<MerkleNode> one;
+        if(!load(sizeof(MERKLE_MAGIC), bytes, buf) || !parse(buf, 1, one))
+            return false;
+        n = std::move(one[0]);
+        return true;
+    }
+
+    /* the children of n, in name order */
+    bool children(const MerkleNode& n, std::vector<MerkleNode>& out) {
+        out.clear();
+        std::string buf;
+        return n.kids == 0 || (load(n.kids_off, n.kids_bytes, buf) && parse(buf, n.kids, out));
+    }
+
+   private:
+    bool read(uint64_t off, void* dst, std::size_t len) {
+        if(off > size || len > size - off)
+            return false;
+        if(!file) {
+            memcpy(dst, image.data() + off, len);
+            return true;
+        }
+        return file->read_at(off, dst, len) == (long long)len;
+    }
+
+    bool load(uint64_t off, uint64_t len, std::string& buf) {
+        if(off > size || len > size - off)
+            return false;
+        buf.resize((std::size_t)len);
+        return len == 0 || read(off, &buf[0], (std::size_t)len);
+    }
+
+    static bool parse(const std::string& buf, uint32_t count, std::vector<MerkleNode>& out) {
+        std::size_t off = 0;
+        auto get = [&](void* p, std::size_t n) {
+            if(n > buf.size() - off)
+                return false;
+            memcpy(p, buf.data() + off, n);
+            off += n;
+            return true;
+        };
+        for(uint32_t i = 0; i < count; ++i) {
+            MerkleNode n;
+            uint32_t len = 0;
+            if(!get(&len, sizeof(len)) || len > (buf.size() - off) / sizeof(PathString::value_type))
+                return false;
+            n.name.resize(len);
+            if(!get(&n.name[0], len * sizeof(PathString::value_type)) || !get(n.files, sizeof(n.files)) ||
+               !get(n.tree, sizeof(n.tree)) || !get(&n.flags, 1) || !get(&n.kids, sizeof(n.kids)) ||
+               !get(&n.kids_off, sizeof(n.kids_off)) || !get(&n.kids_bytes, sizeof(n.kids_bytes)))
+                return false;
+            out.push_back(std::move(n));
+        }
+        return off == buf.size();
+    }
+
+    std::unique_ptr<FileReader> file;
+    std::string image;
+    uint64_t size = 0;
+};
+
+/*
+ * Walks both trees from the root and only reads the children of directories whose tree hashes
+ * differ, so the work is proportional to what changed. A directory marked broken on either side
+ * is always entered, and a failed one is reported as an error instead of as in sync.
+ * false when a merkle file turned out to be truncated or corrupt.
+ */
+bool merkle_compare(MerkleReader& a, MerkleReader& b, const ReportOptions& opt) {
+    struct Pair {
+        PathString path;
+        MerkleNode a, b;
+    };
+    Pair top;
+    top.path = fs::path(L".").native();
+    if(!a.root(top.a) || !b.root(top.b))
+        return false;
+
+    if(opt.header) {
+        wprintf(L"%s%s", L"区分", opt.sep);
+        wprintf(L"%s\n", L"フォルダパス");
+    }
+    std::vector<Pair> todo = {std::move(top)};
+    std::vector<MerkleNode> ka, kb;
+    std::vector<Pair> next;
+    while(!todo.empty()) {
+        Pair p = std::move(todo.back());
+        todo.pop_back();
+        unsigned char flags = p.a.flags | p.b.flags;
+        if(memcmp(p.a.tree, p.b.tree, sizeof(p.a.tree)) == 0 && !(flags & MERKLE_BROKEN))
+            continue;
+        if(flags & MERKLE_FAILED)
+            wprintf(L"%s%s%s\n", L"エラー", opt.sep, fs::path(p.path).c_str());
+        else if(memcmp(p.a.files, p.b.files, sizeof(p.a.files)) != 0)
+            wprintf(L"%s%s%s\n", L"変更", opt.sep, fs::path(p.path).c_str());
+        if(!a.children(p.a, ka) || !b.children(p.b, kb))
+            return false;
+        auto path_of = [&p](const PathString& name) {
+            return p.path == fs::path(L".").native() ? name : (fs::path(p.path) / name).native();
+        };
+        /* both runs are sorted by name: merge them */
+        next.clear();
+        std::size_t i = 0, j = 0;
+        while(i < ka.size() || j < kb.size()) {
+            if(j == kb.size() || (i < ka.size() && ka[i].name < kb[j].name)) {
+                wprintf(L"%s%s%s\n", L"削除", opt.sep, fs::path(path_of(ka[i++].name)).c_str());
+            } else if(i == ka.size() || kb[j].name < ka[i].name) {
+                wprintf(L"%s%s%s\n", L"追加", opt.sep, fs::path(path_of(kb[j++].name)).c_str());
+            } else {
+                Pair q;
+                q.path = path_of(ka[i].name);
+                q.a = std::move(ka[i++]);
+                q.b = std::move(kb[j++]);
+                next.push_back(std::move(q));
+            }
+        }
+        todo.insert(todo.end(), std::make_move_iterator(next.rbegin()), std::make_move_iterator(next.rend()));
+    }
+    return true;
+}
+
+/*
+ * --merkle FILE stores the hashes of the scanned tree; --merkle-diff OTHER compares OTHER with
+ * the scanned tree, or with the merkle file given instead of a folder.
+ */
+int run_merkle(const std::vector<wchar_t*>& roots, const ReportOptions& opt, const wchar_t* save, const wchar_t* other,
+               bool content) {
+    if(roots.size() != 1) {
+        std::wcerr << L"--merkle, --merkle-diffに指定できるフォルダは1つです" << std::endl;
+        return 1;
+    }
+    MerkleReader now;
+    if(!(other && now.open(roots[0]))) {
+        ScanRoot r;
+        if(!resolve_root(roots[0], r))
+            return 1;
+        if(r.is_file || r.is_wildcard) {
+            std::wcerr << L"--merkleにはフォルダを指定してください `" << roots[0] << L"`" << std::endl;
+            return 1;
+        }
+        std::vector<MerkleRow> rows;
+        std::string image;
+        if(merkle_scan(r.dir, opt, content, rows))
+            image = merkle_encode(rows);
+        if(image.empty()) {
+            std::wcerr << L"フォルダを読み込めませんでした `" << roots[0] << L"`" << std::endl;
+            return 1;
+        }
+        if(save && !merkle_save(save, image)) {
+            std::wcerr << L"マークルファイルを書き込めませんでした `" << save << L"`" << std::endl;
+            return 1;
+        }
+        now.assign(std::move(image));
+    }
+    MerkleNode root;
+    if(!now.root(root)) {
+        std::wcerr << L"マークルファイルを読み込めませんでした `" << roots[0] << L"`" << std::endl;
+        return 1;
+    }
+    if(root.flags & MERKLE_BROKEN)
+        std::wcerr << L"読み込めなかったフォルダまたはファイルがあります。そのフォルダは一致とみなされません" << std::endl;
+    if(!other) {
+        if(opt.header)
+            wprintf(L"%s%s%s\n", L"フォルダパス", opt.sep, L"ハッシュ");
+        wprintf(L"%s%s%S\n", roots[0], opt.sep, to_hex(root.tree, sizeof(root.tree)).c_str());
+        return 0;
+    }
+    MerkleReader old;
+    if(!old.open(other)) {
+        std::wcerr << L"マークルファイルを読み込めませんでした `" << other << L"`" << std::endl;
+        return 1;
+    }
+    if(!merkle_compare(old, now, opt)) {
+        std::wcerr << L"マークルファイルが壊れています" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+struct CompareRow {
+    const wchar_t* kind;
+    std::wstring fields;
+    PathString path; /* relative to both roots */
+    bool has_a, has_b;
+    StatInfo a, b;
+};
+
+/*
+ * --compare A B. Each directory pair is one pool task: both sides are listed, sorted by name and
+ * merge-joined, and subdirectories present on both sides become new tasks, so the two storages are
+ * read concurrently. Only differences allocate a row; identical subtrees cost their listings only.
+ * A directory missing on one side is reported once, without its contents.
+ */
+int print_compare(const std::vector<wchar_t*>& roots, const ReportOptions& opt) {
+    if(roots.size() != 2 || !fs::is_directory(roots[0]) || !fs::is_directory(roots[1])) {
+        std::wcerr << L"--compareには比較する2つのフォルダを指定してください" << std::endl;
+        return 1;
+    }
+    const fs::path ra(roots[0]), rb(roots[1]);
+    TaskPool pool(opt.jobs, true);
+    std::vector<std::vector<CompareRow>> found(pool.size());
+
+    using Listing = std::vector<std::pair<PathString, StatInfo>>;
+    auto list = [](const fs::path& dir, Listing& out) {
+        bool ok = read_dir(dir, false, [&out](const fs::path& p, const StatInfo& st) {
+            if(!is_lockfile(p))
+                out.emplace_back(p.filename().native(), st);
+        });
+        std::sort(out.begin(), out.end(), [](const Listing::value_type& x, const Listing::value_type& y) {
+            return x.first < y.first;
+        });
+        return ok;
+    };
+
+    std::function<void(unsigned, PathString, int)> visit = [&](unsigned tid, PathString rel, int depth) {
+        Listing la, lb;
+        bool oka = list(ra / rel, la), okb = list(rb / rel, lb);
+        auto& rows = found[tid];
+        if(!oka || !okb) {
+            rows.push_back({L"読込不可", oka ? L"B" : okb ? L"A" : L"A,B", rel, false, false, StatInfo(), StatInfo()});
+            return;
+        }
+        auto ia = la.begin(), ib = lb.begin();
+        while(ia != la.end() || ib != lb.end()) {
+            int c = ia == la.end() ? 1 : ib == lb.end() ? -1 : ia->first.compare(ib->first);
+            if(c < 0) {
+                rows.push_back({L"欠落", L"", (fs::path(rel) / ia->first).native(), true, false, ia->second, StatInfo()});
+                ++ia;
+                continue;
+            }
+            if(c > 0) {
+                rows.push_back({L"余分", L"", (fs::path(rel) / ib->first).native(), false, true, StatInfo(), ib->second});
+                ++ib;
+                continue;
+            }
+            const StatInfo &a = ia->second, &b = ib->second;
+            PathString p = (fs::path(rel) / ia->first).native();
+            bool dir_a = a.is_dir && !a.is_link, dir_b = b.is_dir && !b.is_link;
+            if(dir_a != dir_b || a.is_link != b.is_link) {
+                rows.push_back({L"変更", L"type", std::move(p), true, true, a, b});
+            } else if(dir_a) {
+                /* directory times follow their contents, which are compared themselves */
+                if(depth < opt.maxdepth)
+                    pool.submit([&visit, p, depth](unsigned t) { visit(t, p, depth + 1); });
+            } else if(a.size != b.size || a.mtime != b.mtime) {
+                std::wstring fields = a.size != b.size ? L"size" : L"";
+                if(a.mtime != b.mtime)
+                    fields += fields.empty() ? L"mtime" : L",mtime";
+                rows.push_back({L"変更", std::move(fields), std::move(p), true, true, a, b});
+            }
+            ++ia;
+            ++ib;
+        }
+    };
+    pool.submit([&visit](unsigned t) { visit(t, PathString(), 0); });
+    pool.wait();
+
+    std::vector<CompareRow> rows;
+    for(auto& f : found)
+        rows.insert(rows.end(), std::make_move_iterator(f.begin()), std::make_move_iterator(f.end()));
+    std::sort(rows.begin(), rows.end(), [](const CompareRow& x, const CompareRow& y) { return x.path < y.path; });
+
+    if(opt.header) {
+        wprintf(L"%s%s", L"区分", opt.sep);
+        wprintf(L"%s%s", L"変更項目", opt.sep);
+        wprintf(L"%s%s(A)%s", L"サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s(B)%s", L"サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s(A)%s", L"更新日時", opt.sep);
+        wprintf(L"%s(B)%s", L"更新日時", opt.sep);
+        wprintf(L"%s\n", L"相対パス");
+    }
+    for(auto& r : rows) {
+        wprintf(L"%s%s", r.kind, opt.sep);
+        wprintf(L"%s%s", r.fields.c_str(), opt.sep);
+        for(auto* st : {r.has_a ? &r.a : NULL, r.has_b ? &r.b : NULL}) {
+            if(st)
+                wprintf(L"%llu", (unsigned long long)(st->size / opt.unit));
+            wprintf(L"%s", opt.sep);
+        }
+        for(auto* st : {r.has_a ? &r.a : NULL, r.has_b ? &r.b : NULL}) {
+            if(st)
+                FileInfo::datetimestr((time_t)st->mtime, opt.format);
+            wprintf(L"%s", opt.sep);
+        }
+        wprintf(L"%s\n", fs::path(r.path.empty() ? fs::path(L".").native() : r.path).c_str());
+    }
+    return 0;
+}
+
+struct RelinkRow {
+    const wchar_t* kind;
+    fs::path path;
+    std::string before, after;
+};
+
+/*
+ * writes data to a new file next to p and renames it over p, so p is never seen half written. The
+ * temporary name is random and created exclusively, so two runs never write into one file. Nothing
+ * is left behind when a write fails.
+ */
+bool replace_file(const fs::path& p, const std::vector<unsigned char>& data) {
+    static thread_local std::mt19937_64 rng(std::random_device{}() ^
+                                            (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+    wchar_t name[32];
+    swprintf(name, sizeof(name) / sizeof(name[0]), L".%016llx.tmp", (unsigned long long)rng());
+    fs::path tmp = p.native() + fs::path(name).native();
+#ifdef _WIN32
+    FILE* fp = NULL;
+    if(_wfopen_s(&fp, tmp.c_str(), L"wbx") != 0)
+        return false;
+#else
+    FILE* fp = fopen(tmp.c_str(), "wbx");
+    if(fp == NULL)
+        return false;
+#endif
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    ok = fflush(fp) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+    std::error_code ec;
+    if(ok)
+        fs::rename(tmp, p, ec);
+    if(!ok || ec)
+        fs::remove(tmp, ec);
+    return ok && !ec;
+}
+
+/*
+ * --relink OLD=NEW: replaces OLD by NEW in the target, network path and working directory of every
+ * shortcut below the roots. Directories are walked in parallel and each shortcut is rewritten on the
+ * walker thread that listed it. LnkRewriter patches the strings into the shortcut's own bytes, so the
+ * show command, times, arguments, icon and extra data survive and the new target need not exist; the
+ * result replaces the original through replace_file. Shortcuts OLD does not match are not written.
+ * With --dry-run nothing is written and the planned changes are listed.
+ */
+int run_relink(const std::vector<wchar_t*>& roots, const ReportOptions& opt, const wchar_t* spec, bool dry_run) {
+    const wchar_t* eq = wcschr(spec, L'=');
+    if(eq == NULL || eq == spec) {
+        std::wcerr << L"--relinkは 置換前=置換後 の形式で指定してください `" << spec << L"`" << std::endl;
+        return 1;
+    }
+    /* LinkInfo holds the paths in the ANSI code page and in UTF-16, StringData in either */
+    const fs::path before(std::wstring(spec, eq)), after(eq + 1);
+    const LnkRewriter rewriter(before.string(), after.string(), before.u16string(), after.u16string());
+
+    std::vector<RelinkRow> rows;
+    std::mutex mtx;
+    auto relink_one = [&](const fs::path& p) {
+        static const uint64_t MAX_LINK = 16 << 20;
+        RelinkRow row = {L"失敗", p, std::string(), std::string()};
+        FileReader f(p);
+        std::vector<unsigned char> link, out;
+        bool changed = false;
+        if(f.is_open() && f.size() <= MAX_LINK) {
+            link.resize((std::size_t)f.size());
+            LnkView view, now;
+            if(f.read_at(0, link.data(), link.size()) == (long long)link.size() &&
+               rewriter.rewrite(link.data(), link.size(), out, changed) && view.parse(link.data(), link.size())) {
+                if(!changed)
+                    return;
+                row.before = std::string(view.target.empty() ? view.networkPath : view.target);
+                /* a link that does not read back is never written over the user's shortcut */
+                if(now.parse(out.data(), out.size()) && now.complete) {
+                    row.after = std::string(now.target.empty() ? now.networkPath : now.target);
+                    row.kind = dry_run ? L"変更予定" : replace_file(p, out) ? L"変更" : L"失敗";
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        rows.push_back(std::move(row));
+    };
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
+            return 1;
+        if(r.is_file) {
+            if(is_shortcut(r.pattern))
+                relink_one(r.pattern);
+            continue;
+        }
+        DirWalker<> walker(opt.jobs);
+        walker.maxdepth = opt.maxdepth;
+        walker.on_entry = [&](unsigned, const WalkEntry& e, DirWalker<>::Node&) {
+            if(!e.st.is_dir && !e.st.is_link && is_shortcut(e.path) && match_root(r, e.path))
+                relink_one(e.path);
+            return e.st.is_dir;
+        };
+        walker.add(r.dir);
+        walker.wait();
+    }
+
+    std::sort(rows.begin(), rows.end(), [](const RelinkRow& x, const RelinkRow& y) { return x.path < y.path; });
+    if(opt.header) {
+        wprintf(L"%s%s", L"区分", opt.sep);
+        wprintf(L"%s%s", L"変更前リンク先", opt.sep);
+        wprintf(L"%s%s", L"変更後リンク先", opt.sep);
+        wprintf(L"%s\n", L"フルパス");
+    }
+    int failed = 0;
+    for(auto& r : rows) {
+        failed += wcscmp(r.kind, L"失敗") == 0;
+        wprintf(L"%s%s", r.kind, opt.sep);
+        wprintf(L"%S%s", r.before.c_str(), opt.sep);
+        wprintf(L"%S%s", r.after.c_str(), opt.sep);
+        wprintf(L"%s\n", r.path.c_str());
+    }
+    return failed ? 1 : 0;
+}
+
+/* a member of an archive, listed by --into-archives as a row of its own */
+struct InnerRow {
+    fs::path path;
+    struct _stat st;
+};
+
+/* members of archive p as archive.zip!/inner/path rows, sized and dated as stored. directories only with dirs */
+void archive_rows(const fs::path& p, bool dirs, std::vector<InnerRow>& rows) {
+    const PathString bang = fs::path("!/").native();
+    list_archive(p, [&](const ArchiveEntry& e) {
+        if(e.is_dir && !dirs)
+            return;
+        std::size_t b = e.name.find_first_not_of("/\\"), l = e.name.find_last_not_of("/\\");
+        if(b == std::string::npos)
+            return;
+        std::string name = e.name.substr(b, l - b + 1);
+        InnerRow r;
+        r.path = fs::path(p.native() + bang + (e.utf8 ? fs::u8path(name) : fs::path(name)).native());
+        memset(&r.st, 0, sizeof(r.st));
+        r.st.st_size = e.size;
+        r.st.st_atime = r.st.st_mtime = r.st.st_ctime = e.mtime;
+        r.st.st_mode = e.is_dir ? (_S_IFDIR | 0555) : (_S_IFREG | 0444);
+        rows.push_back(std::move(r));
+    });
+}
+
+/* a listing row whose slow columns (h, t, -l, n/w/r/e) are filled in on a pool thread before it is printed */
+struct PendingRow {
+    fs::path path;
+    struct _stat st;
+    std::string digest;
+    LnkDetails lnk;
+    const wchar_t* target_state;
+    int link; /* as FileInfo::link */
+    fs::path link_path;
+    const wchar_t* file_type;
+    std::vector<InnerRow> inner; /* --into-archives */
+};
+
+/* rows worked on ahead of the one being printed. bounds memory and open files when output is slow */
+static const std::size_t ROW_WINDOW = 256;
+/* shortcuts of one directory resolved per task */
+static const std::size_t LNK_BATCH = 32;
+
+void hash_row(PendingRow& row, bool sha256, std::vector<unsigned char>& buf) {
+    bool ok = sha256 ? digest_file<Sha256>(row.path, buf, row.digest) : digest_file<Murmur3>(row.path, buf, row.digest);
+    if(!ok)
+        row.digest = "?";
+}
+
+FileRecord make_record(const fs::path& p, const struct _stat& st) {
+    FileRecord r;
+    r.size = (uint64_t)st.st_size;
+    r.atime = st.st_atime;
+    r.mtime = st.st_mtime;
+    r.ctime = st.st_ctime;
+    r.ino = (uint64_t)st.st_ino;
+    r.mode = st.st_mode;
+    r.path = p.native();
+    r.name_off = (uint32_t)(r.path.size() - p.filename().native().size());
+    return r;
+}
+
+struct _stat record_stat(const FileRecord& r) {
+    struct _stat st = {0};
+    st.st_size = r.size;
+    st.st_atime = r.atime;
+    st.st_mtime = r.mtime;
+    st.st_ctime = r.ctime;
+    st.st_mode = r.mode;
+    return st;
+}
+
+ExternalSorter<FileRecord>::Less record_order(const wchar_t* by, bool reverse) {
+    ExternalSorter<FileRecord>::Less less;
+    if(wcscmp(by, L"size") == 0)
+        less = [](const FileRecord& x, const FileRecord& y) { return x.size != y.size ? x.size < y.size : x.path < y.path; };
+    else if(wcscmp(by, L"mtime") == 0)
+        less = [](const FileRecord& x, const FileRecord& y) { return x.mtime != y.mtime ? x.mtime < y.mtime : x.path < y.path; };
+    else if(wcscmp(by, L"name") == 0)
+        less = [](const FileRecord& x, const FileRecord& y) { return x.compare_name(y) < 0; };
+    else if(wcscmp(by, L"path") == 0)
+        less = [](const FileRecord& x, const FileRecord& y) { return x.path < y.path; };
+    if(less && reverse)
+        return [less](const FileRecord& x, const FileRecord& y) { return less(y, x); };
+    return less;
+}
+
+/* "512M" style byte counts, K/M/G suffixes. 0 on error */
+uint64_t parse_bytes(const wchar_t* s) {
+    wchar_t* end = NULL;
+    double v = wcstod(s, &end);
+    if(end == s || v <= 0)
+        return 0;
+    switch(*end) {
+        case L'\0': break;
+        case L'k': case L'K': v *= 1024.0; ++end; break;
+        case L'm': case L'M': v *= 1024.0 * 1024; ++end; break;
+        case L'g': case L'G': v *= 1024.0 * 1024 * 1024; ++end; break;
+        default: return 0;
+    }
+    if(*end == L'b' || *end == L'B')
+        ++end;
+    return *end ? 0 : (uint64_t)v;
+}
+
+FileRecord make_record(const fs::path& p, const StatInfo& st) {
+    FileRecord r;
+    r.size = st.size;
+    r.atime = st.atime;
+    r.mtime = st.mtime;
+    r.ctime = st.ctime;
+    r.ino = st.ino;
+    r.mode = st.mode;
+    r.path = p.native();
+    r.name_off = (uint32_t)(r.path.size() - p.filename().native().size());
+    return r;
+}
+
+static const char SNAPSHOT_MAGIC[8] = {'L', 'S', 'D', 'S', 'N', 'A', 'P', '1'};
+
+/* walks every root in parallel and feeds the listed entries to sorter in batches. cache makes the walk incremental */
+bool collect_records(const std::vector<wchar_t*>& roots, const ReportOptions& opt, ExternalSorter<FileRecord>& sorter,
+                     DirStateCache* cache = NULL) {
+    static const std::size_t BATCH = 1024;
+    std::mutex mtx;
+    bool ok = true;
+    auto flush = [&](std::vector<FileRecord>& batch) {
+        std::lock_guard<std::mutex> lk(mtx);
+        for(auto& rec : batch)
+            ok = sorter.add(std::move(rec)) && ok;
+        batch.clear();
+    };
+
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
+            return false;
+        if(r.is_file) {
+            StatInfo st;
+            if(stat_path(r.pattern, st, true))
+                ok = sorter.add(make_record(r.pattern, st)) && ok;
+            continue;
+        }
+
+        DirWalker<> walker(opt.jobs);
+        walker.maxdepth = opt.maxdepth;
+        walker.identity = true;
+        if(cache) {
+            walker.reader = [&](unsigned, DirWalker<>::Node& node, const DirWalker<>::EntryFn& f) {
+                return cache->read(node.path, walker.identity, f);
+            };
+        }
+        std::vector<std::vector<FileRecord>> batches(walker.threads());
+        walker.on_entry = [&](unsigned tid, const WalkEntry& e, DirWalker<>::Node&) {
+            if(e.st.is_dir && !opt.dirs)
+                return true;
+            if(!is_lockfile(e.path) && match_root(r, e.path)) {
+                batches[tid].push_back(make_record(e.path, e.st));
+                if(batches[tid].size() == BATCH)
+                    flush(batches[tid]);
+            }
+            return e.st.is_dir;
+        };
+        walker.add(r.dir);
+        walker.wait();
+        for(auto& b : batches)
+            flush(b);
+    }
+    if(!ok)
+        std::wcerr << L"一時ファイルを書き込めませんでした。空き容量またはTEMPの設定を確認してください" << std::endl;
+    return ok;
+}
+
+/* names of the fields that differ, empty when the entry is unchanged. atime is ignored */
+std::wstring changed_fields(const FileRecord& was, const FileRecord& now) {
+    std::wstring s;
+    auto add = [&s](const wchar_t* name) {
+        if(!s.empty())
+            s += L',';
+        s += name;
+    };
+    if(was.size != now.size)
+        add(L"size");
+    if(was.mtime != now.mtime)
+        add(L"mtime");
+    if(was.mode != now.mode)
+        add(L"mode");
+    if(was.ino && now.ino && was.ino != now.ino)
+        add(L"inode");
+    return s;
+}
+
+/*
+ * --snapshot / --diff. the scan is sorted by path with the --sort-mem budget, then merge-joined
+ * against the old snapshot (also in path order) while the new snapshot is written out,
+ * so memory stays bounded however large either side is.
+ */
+using Collector = std::function<bool(ExternalSorter<FileRecord>&)>;
+
+int run_snapshot(const ReportOptions& opt, const wchar_t* snapshot, const wchar_t* diff, std::size_t budget,
+                 const Collector& collect) {
+    FILE* old = NULL;
+    if(diff) {
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        old = open_binary(diff, false);
+        if(old == NULL || fread(magic, 1, sizeof(magic), old) != sizeof(magic) ||
+           memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+            std::wcerr << L"スナップショットファイルを読み込めませんでした `" << diff << L"`" << std::endl;
+            if(old)
+                fclose(old);
+            return 1;
+        }
+    }
+
+    /* written next to the target and renamed at the end, so a failed run keeps the previous snapshot */
+    fs::path snap_tmp;
+    FILE* out = NULL;
+    if(snapshot) {
+        snap_tmp = fs::path(snapshot).native() + fs::path(L".tmp").native();
+        out = open_binary(snap_tmp, true);
+        if(out == NULL || fwrite(SNAPSHOT_MAGIC, 1, sizeof(SNAPSHOT_MAGIC), out) != sizeof(SNAPSHOT_MAGIC)) {
+            std::wcerr << L"スナップショットファイルを書き込めませんでした `" << snapshot << L"`" << std::endl;
+            if(out)
+                fclose(out);
+            if(old)
+                fclose(old);
+            return 1;
+        }
+    }
+
+    ExternalSorter<FileRecord> sorter([](const FileRecord& x, const FileRecord& y) { return x.path < y.path; }, budget);
+    if(!collect(sorter)) {
+        if(out)
+            fclose(out);
+        if(old)
+            fclose(old);
+        return 1;
+    }
+
+    if(diff && opt.header) {
+        wprintf(L"%s%s", L"区分", opt.sep);
+        wprintf(L"%s%s", L"変更項目", opt.sep);
+        wprintf(L"%s%s%s", L"サイズ", unit_suffix(opt.unit), opt.sep);
+        wprintf(L"%s%s", L"更新日時", opt.sep);
+        wprintf(L"%s\n", L"フルパス");
+    }
+    auto print_row = [&](const wchar_t* kind, const std::wstring& fields, const FileRecord& rec) {
+        wprintf(L"%s%s", kind, opt.sep);
+        wprintf(L"%s%s", fields.c_str(), opt.sep);
+        wprintf(L"%llu%s", (unsigned long long)(rec.size / opt.unit), opt.sep);
+        FileInfo::datetimestr((time_t)rec.mtime, opt.format);
+        wprintf(L"%s", opt.sep);
+        wprintf(L"%s\n", fs::path(rec.path).c_str());
+    };
+
+    FileRecord was;
+    bool has_old = old && was.read(old);
+    bool write_ok = true;
+    bool sort_ok = sorter.drain([&](const FileRecord& now) {
+        if(out)
+            write_ok = write_ok && now.write(out);
+        if(!old)
+            return;
+        for(; has_old && was.path < now.path; has_old = was.read(old))
+            print_row(L"削除", std::wstring(), was);
+        if(has_old && was.path == now.path) {
+            std::wstring fields = changed_fields(was, now);
+            if(!fields.empty())
+                print_row(L"変更", fields, now);
+            has_old = was.read(old);
+        } else {
+            print_row(L"追加", std::wstring(), now);
+        }
+    });
+    for(; has_old; has_old = was.read(old))
+        print_row(L"削除", std::wstring(), was);
+    if(old)
+        fclose(old);
+
+    if(out) {
+        write_ok = fclose(out) == 0 && write_ok && sort_ok;
+        std::error_code ec;
+        if(write_ok)
+            fs::rename(snap_tmp, snapshot, ec);
+        if(!write_ok || ec) {
+            fs::remove(snap_tmp, ec);
+            std::wcerr << L"スナップショットファイルを書き込めませんでした `" << snapshot << L"`" << std::endl;
+            return 1;
+        }
+    }
+    if(!sort_ok) {
+        std::wcerr << L"一時ファイルを書き込めませんでした。空き容量またはTEMPの設定を確認してください" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * --stat-cache: the stat fields FileInfo prints, in a memory-mapped table shared between runs
+ * and concurrent processes. Entries are keyed by the directory's (dev, ino, mtime, ctime) and
+ * the file name, so one directory stat validates all of its files; renames, creations and
+ * deletions change the directory times. An in-place rewrite that keeps the directory times
+ * is served from the cache.
+ */
+class StatCache {
+   public:
+    bool open(const fs::path& p) { return table.open(p, MAGIC); }
+
+    void stat(const fs::path& p, struct _stat& st) {
+        memset(&st, 0, sizeof(st));
+        fs::path dir = p.parent_path();
+        if(dir != cur_dir) {
+            cur_dir = dir;
+            dir_ok = stat_path(dir, dir_st, true);
+        }
+        if(!dir_ok) {
+            _wstat(p.c_str(), &st);
+            return;
+        }
+        Murmur3 h;
+        h.update(&dir_st.dev, sizeof(dir_st.dev));
+        h.update(&dir_st.ino, sizeof(dir_st.ino));
+        h.update(&dir_st.mtime, sizeof(dir_st.mtime));
+        h.update(&dir_st.ctime, sizeof(dir_st.ctime));
+        const auto& name = p.filename().native();
+        h.update(name.data(), name.size() * sizeof(name[0]));
+        uint64_t key[2];
+        h.finish((unsigned char*)key);
+
+        Entry e;
+        if(table.find(key[0], key[1], e)) {
+            st.st_size = e.size;
+            st.st_atime = e.atime;
+            st.st_mtime = e.mtime;
+            st.st_ctime = e.ctime;
+            st.st_mode = e.mode;
+            return;
+        }
+        if(_wstat(p.c_str(), &st) == 0)
+            table.store(key[0], key[1], {(uint64_t)st.st_size, st.st_atime, st.st_mtime, st.st_ctime, (uint32_t)st.st_mode});
+    }
+
+   private:
+    static const uint32_t MAGIC = 0x3143534c; /* "LSC1" */
+    struct Entry {
+        uint64_t size;
+        int64_t atime;
+        int64_t mtime;
+        int64_t ctime;
+        uint32_t mode;
+    };
+
+    MmapTable<Entry> table;
+    fs::path cur_dir;
+    StatInfo dir_st;
+    bool dir_ok = false;
+};
+
+/*
+ * --lnk-cache: everything the listing reads from a shortcut (target, network path, working
+ * directory, arguments, description) in a memory-mapped table keyed by the shortcut's path, dev,
+ * ino, size and mtime, all taken from the listing's stat, so a hit never opens the shortcut.
+ * Files that are not readable shortcuts are cached as such. Details that do not fit an entry
+ * are read every time.
+ */
+class LnkCache {
+   public:
+    bool open(const fs::path& p) { return table.open(p, MAGIC, 1 << 16); }
+
+    /* fills d like LnkTarget::read_details. false when p is not a readable shortcut */
+    bool details(const fs::path& p, const struct _stat& st, LnkDetails& d) {
+        Murmur3 h;
+        const auto& path = p.native();
+        h.update(path.data(), path.size() * sizeof(path[0]));
+        uint64_t id[4] = {(uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size, (uint64_t)st.st_mtime};
+        h.update(id, sizeof(id));
+        uint64_t key[2];
+        h.finish((unsigned char*)key);
+
+        Entry e;
+        if(table.find(key[0], key[1], e) && unpack(e, d))
+            return e.kind == LINK;
+        bool ok = LnkTarget().read_details(p, d);
+        if(pack(ok, d, e))
+            table.store(key[0], key[1], e);
+        return ok;
+    }
+
+   private:
+    static const uint32_t MAGIC = 0x324b4c4c; /* "LLK2" */
+    enum Kind : unsigned char { LINK = 1, NOT_LINK = 2 };
+    struct Entry {
+        unsigned char kind;
+        unsigned char reserved;
+        uint16_t len[5]; /* bytes of target, network, description, arguments, working_dir in data */
+        char data[1012];
+    };
+
+    static bool pack(bool ok, const LnkDetails& d, Entry& e) {
+        memset(&e, 0, sizeof(e));
+        e.kind = ok ? LINK : NOT_LINK;
+        const std::pair<const void*, std::size_t> f[5] = {
+            {d.target.data(), d.target.size()},
+            {d.network.data(), d.network.size()},
+            {d.description.data(), d.description.size() * sizeof(wchar_t)},
+            {d.arguments.data(), d.arguments.size() * sizeof(wchar_t)},
+            {d.working_dir.data(), d.working_dir.size() * sizeof(wchar_t)}};
+        std::size_t used = 0;
+        for(int i = 0; i < 5; ++i) {
+            if(f[i].second > sizeof(e.data) - used)
+                return false;
+            memcpy(e.data + used, f[i].first, f[i].second);
+            e.len[i] = (uint16_t)f[i].second;
+            used += f[i].second;
+        }
+        return true;
+    }
+
+    static bool unpack(const Entry& e, LnkDetails& d) {
+        std::size_t used = 0;
+        for(auto n : e.len)
+            used += n;
+        if((e.kind != LINK && e.kind != NOT_LINK) || used > sizeof(e.data) || e.len[2] % sizeof(wchar_t) ||
+           e.len[3] % sizeof(wchar_t) || e.len[4] % sizeof(wchar_t))
+            return false;
+        const char* p = e.data;
+        auto wide = [&p](std::wstring& w, std::size_t n) {
+            w.resize(n / sizeof(wchar_t));
+            memcpy(&w[0], p, n);
+            p += n;
+        };
+        d.target.assign(p, e.len[0]);
+        p += e.len[0];
+        d.network.assign(p, e.len[1]);
+        p += e.len[1];
+        wide(d.description, e.len[2]);
+        wide(d.arguments, e.len[3]);
+        wide(d.working_dir, e.len[4]);
+        return true;
+    }
+
+    MmapTable<Entry> table;
+};
+
+/*
+ * --check-targets: whether the target of a shortcut or symlink exists. Each target directory is
+ * listed once into a name set and every later link into it is answered from that set, so links
+ * into a few folders cost a few listings instead of one stat each. A listing below \\server is
+ * given timeout seconds; a server that does not answer in time is not asked again.
+ */
+class TargetChecker {
+   public:
+    enum State { NONE, OK, MISSING, UNREACHABLE };
+
+    explicit TargetChecker(int timeout) : timeout(timeout) {}
+
+    static const wchar_t* name(State s) {
+        switch(s) {
+            case OK: return L"OK";
+            case MISSING: return L"MISSING";
+            case UNREACHABLE: return L"UNREACHABLE";
+            default: return L"";
+        }
+    }
+
+    /* target of link p: its symlink target made absolute, else a shortcut's path. empty when p is neither */
+    static fs::path link_target(const fs::path& p, const std::string& lnk_target, const fs::path& symlink) {
+        if(!symlink.empty())
+            return symlink.is_absolute() ? symlink : p.parent_path() / symlink;
+        return is_shortcut(p) ? fs::path(lnk_target) : fs::path();
+    }
+
+    /* NONE for an empty target, i.e. not a link or one without a path */
+    State check(const fs::path& target) {
+        if(target.empty())
+            return NONE;
+        fs::path t = target.lexically_normal();
+        if(!t.has_filename() && t.has_relative_path())
+            t = t.parent_path(); /* trailing separator */
+        fs::path dir = t.parent_path();
+        if(!t.has_relative_path() || dir == t)
+            return listing(t)->state; /* a drive or share root: OK when it can be listed */
+        const Listing* l = listing(dir);
+        if(l->state != OK)
+            return l->state;
+        return l->names.find(fold(t.filename().native())) ? OK : MISSING;
+    }
+
+   private:
+    struct Listing {
+        State state = UNREACHABLE; /* OK once listed, MISSING when the directory does not exist */
+        OpenHashMap<PathString, char> names;
+    };
+    struct Slot {
+        std::once_flag once;
+        std::shared_ptr<const Listing> listing;
+    };
+
+    /* names compare the way the file system does: without case on Windows */
+    static PathString fold(PathString s) {
+#ifdef _WIN32
+        for(auto& c : s)
+            c = (wchar_t)towlower(c);
+#endif
+        return s;
+    }
+
+    /* \\server of a UNC path, empty for a local one */
+    static PathString server(const fs::path& p) {
+        static const fs::path::value_type seps[] = {'\\', '/', 0};
+        const PathString& s = p.native();
+        if(s.size() < 3 || (s[0] != '\\' && s[0] != '/') || s[1] != s[0])
+            return PathString();
+        return s.substr(0, s.find_first_of(seps, 2));
+    }
+
+    static std::shared_ptr<const Listing> read_listing(const fs::path& dir) {
+        auto l = std::make_shared<Listing>();
+        if(list_names(dir, [&](const fs::path::value_type* n) { l->names[fold(n)] = 1; })) {
+            l->state = OK;
+        } else {
+            std::error_code ec;
+            fs::file_status s = fs::status(dir, ec);
+            if(s.type() == fs::file_type::not_found || (s.type() != fs::file_type::unknown && !fs::is_directory(s)))
+                l->state = MISSING;
+        }
+        return l;
+    }
+
+    const Listing* listing(const fs::path& dir) {
+        PathString key = fold(dir.native());
+        PathString host = server(dir);
+        Slot* slot;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if(!host.empty() && dead.count(host))
+                return &unreachable;
+            std::unique_ptr<Slot>& s = slots[key];
+            if(!s)
+                s.reset(new Slot());
+            slot = s.get();
+        }
+        /* concurrent checks into one directory wait for the single listing */
+        std::call_once(slot->once, [&] {
+            if(host.empty()) {
+                slot->listing = read_listing(dir);
+                return;
+            }
+            /* the listing thread is left behind on timeout; it owns everything it touches */
+            std::packaged_task<std::shared_ptr<const Listing>()> task([dir] { return read_listing(dir); });
+            auto result = task.get_future();
+            std::thread(std::move(task)).detach();
+            if(result.wait_for(std::chrono::seconds(timeout)) == std::future_status::ready) {
+                slot->listing = result.get();
+            } else {
+                std::lock_guard<std::mutex> lk(mtx);
+                dead.insert(host);
+            }
+        });
+        return slot->listing ? slot->listing.get() : &unreachable;
+    }
+
+    int timeout;
+    Listing unreachable;
+    std::mutex mtx;
+    std::unordered_map<PathString, std::unique_ptr<Slot>> slots;
+    std::unordered_set<PathString> dead;
+};
+
+/*
+ * --canonical: final target of a symlink with every symlink on the way resolved, like realpath.
+ * Paths are resolved one component at a time below an already canonical parent, and each
+ * (parent, name) step is remembered, so links that all go through /opt/current -> release-N
+ * read that link once. Steps that do not exist are kept as they are. A chain longer than MAX_HOPS
+ * (a loop) stops where it is and the rest of the path is kept as it is; no step that depended on
+ * it is remembered, since the same step reached with fewer hops resolves further. Safe for several
+ * threads.
+ */
+class LinkResolver {
+   public:
+    fs::path resolve(const fs::path& p) {
+        bool truncated = false;
+        return resolve(p, 0, truncated);
+    }
+
+   private:
+    static const int MAX_HOPS = 40; /* SYMLOOP_MAX on Linux */
+    static const std::size_t SHARDS = 16;
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<PathString, fs::path> steps;
+    };
+
+    /* truncated is set when a chain ran out of hops on the way */
+    fs::path resolve(const fs::path& p, int hops, bool& truncated) {
+        std::error_code ec;
+        fs::path abs = fs::absolute(p, ec);
+        if(ec)
+            return p;
+        fs::path cur = abs.root_path();
+        for(const auto& c : abs.relative_path()) {
+            if(c.empty() || c == ".")
+                continue;
+            if(c == "..")
+                cur = cur.parent_path();
+            else if(truncated)
+                cur /= c; /* the rest is appended as it is, so a loop costs MAX_HOPS steps, not 2^MAX_HOPS */
+            else
+                cur = step(cur / c, hops, truncated);
+        }
+        return cur;
+    }
+
+    /* q is a canonical directory plus one name */
+    fs::path step(const fs::path& q, int hops, bool& truncated) {
+        Shard& s = shards[OpenHashMap<PathString, char>::hash(q.native()) % SHARDS];
+        {
+            std::lock_guard<std::mutex> lk(s.mtx);
+            auto it = s.steps.find(q.native());
+            if(it != s.steps.end())
+                return it->second;
+        }
+        /* resolved outside the lock: two threads may both resolve q, and they agree */
+        fs::path r = q;
+        std::error_code ec;
+        bool cut = false;
+        if(fs::is_symlink(fs::symlink_status(q, ec))) {
+            if(hops >= MAX_HOPS) {
+                cut = true;
+            } else {
+                fs::path t = fs::read_symlink(q, ec);
+                if(!ec)
+                    r = resolve(t.is_absolute() ? t : q.parent_path() / t, hops + 1, cut);
+            }
+        }
+        if(cut) {
+            truncated = true;
+            return r;
+        }
+        std::lock_guard<std::mutex> lk(s.mtx);
+        s.steps.emplace(q.native(), r);
+        return r;
+    }
+
+    Shard shards[SHARDS];
+};
+
+/*
+ * A subtree handed to a --spool worker, with the filters of its root so the rows come back final.
+ * dir is absolute, since the worker may run elsewhere; the rows are named from shown, the
+ * directory as the root was spelled on the command line. parent and parent_claim name the
+ * claim of the task that published this one (empty for the coordinator's).
+ */
+struct ScanTask {
+    fs::path dir;
+    fs::path shown;
+    int depth = 0; /* depth of dir's entries below the root */
+    int maxdepth = INT_MAX;
+    bool dirs = false;
+    bool is_wildcard = false;
+    std::wstring match;
+    std::string parent;
+    std::string parent_claim;
+
+    /* paths travel as UTF-8, so a task published on one host decodes on another */
+    std::string encode() const {
+        std::string s;
+        auto put = [&s](const void* p, std::size_t n) { s.append((const char*)p, n); };
+        auto put_str = [&put](const std::string& v) {
+            uint32_t len = (uint32_t)v.size();
+            put(&len, sizeof(len));
+            put(v.data(), len);
+        };
+        unsigned char flags = (dirs ? 1 : 0) | (is_wildcard ? 2 : 0);
+        put(&depth, sizeof(depth));
+        put(&maxdepth, sizeof(maxdepth));
+        put(&flags, 1);
+        put_str(dir.u8string());
+        put_str(shown.u8string());
+        put_str(fs::path(match).u8string());
+        put_str(parent);
+        put_str(parent_claim);
+        return s;
+    }
+
+    bool decode(const std::string& s) {
+        std::size_t off = 0;
+        auto get = [&](void* p, std::size_t n) {
+            if(off + n > s.size())
+                return false;
+            memcpy(p, s.data() + off, n);
+            off += n;
+            return true;
+        };
+        auto get_str = [&](std::string& v) {
+            uint32_t len = 0;
+            if(!get(&len, sizeof(len)) || off + len > s.size())
+                return false;
+            v.assign(s, off, len);
+            off += len;
+            return true;
+        };
+        unsigned char flags = 0;
+        std::string d, sh, m;
+        if(!get(&depth, sizeof(depth)) || !get(&maxdepth, sizeof(maxdepth)) || !get(&flags, 1) || !get_str(d) ||
+           !get_str(sh) || !get_str(m) || !get_str(parent) || !get_str(parent_claim))
+            return false;
+        dir = fs::u8path(d);
+        shown = fs::u8path(sh);
+        match = fs::u8path(m).wstring();
+        dirs = (flags & 1) != 0;
+        is_wildcard = (flags & 2) != 0;
+        return true;
+    }
+};
+
+/* what a worker reports in done/: tasks it published, and which claim did the work */
+struct TaskSummary {
+    uint64_t spawned = 0;
+    std::string claim;
+    std::string parent;
+    std::string parent_claim;
+
+    std::string encode() const {
+        return std::to_string(spawned) + "\n" + claim + "\n" + parent + "\n" + parent_claim + "\n";
+    }
+
+    bool decode(const std::string& s) {
+        std::string f[4];
+        std::size_t off = 0;
+        for(auto& v : f) {
+            std::size_t nl = s.find('\n', off);
+            if(nl == s.npos)
+                return false;
+            v = s.substr(off, nl - off);
+            off = nl + 1;
+        }
+        if(f[0].empty() || f[0].find_first_not_of("0123456789") != f[0].npos)
+            return false;
+        spawned = std::stoull(f[0]);
+        claim = f[1];
+        parent = f[2];
+        parent_claim = f[3];
+        return true;
+    }
+};
+
+/* entries a worker lists before it hands the rest of its subtree back to the spool */
+static const std::size_t SPOOL_SPLIT = 10000;
+/* how often a worker checks whether todo/ ran dry, to hand out half of what it has left */
+static const std::chrono::milliseconds SPOOL_BALANCE(200);
+
+/*
+ * Lists one spooled subtree into its rows file. Whenever todo/ runs dry, the older half of the
+ * pending directories (nearest the top, so usually the biggest) is published for the idle
+ * workers, and once SPOOL_SPLIT entries are done everything still pending is. So a huge
+ * subtree spreads out while small ones stay in one task. A heartbeat thread keeps the claim's
+ * lease alive; when the claim was taken back anyway the task stops and its rows are dropped.
+ */
+void run_task(Spool& spool, const std::string& id, const std::string& claim, const std::string& payload) {
+    TaskSummary sum;
+    sum.claim = claim;
+    ScanTask t;
+    if(!t.decode(payload)) {
+        spool.finish(id, claim, sum.encode());
+        return;
+    }
+    sum.parent = t.parent;
+    sum.parent_claim = t.parent_claim;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stop = false;
+    std::atomic<bool> lost(false);
+    std::thread heartbeat([&] {
+        std::unique_lock<std::mutex> lk(mtx);
+        while(!cv.wait_for(lk, Spool::LEASE / 8, [&] { return stop; })) {
+            if(!spool.touch(id, claim))
+                lost = true;
+        }
+    });
+
+    struct Pending {
+        fs::path dir, shown;
+        int depth;
+    };
+    FILE* out = open_binary(spool.rows_tmp(id, claim), true);
+    ScanRoot r;
+    r.is_wildcard = t.is_wildcard;
+    r.match = t.match;
+    std::vector<Pending> todo = {{t.dir, t.shown, t.depth}};
+    std::size_t listed = 0;
+    bool ok = out != NULL;
+    auto hand_out = [&](const Pending& d) {
+        ScanTask sub = t;
+        sub.dir = d.dir;
+        sub.shown = d.shown;
+        sub.depth = d.depth;
+        sub.parent = id;
+        sub.parent_claim = claim;
+        if(spool.publish(spool.new_id(), sub.encode()))
+            ++sum.spawned;
+        else
+            ok = false;
+    };
+    auto balanced = std::chrono::steady_clock::now();
+    while(ok && !lost && !todo.empty()) {
+        if(listed < SPOOL_SPLIT && todo.size() > 1 && std::chrono::steady_clock::now() - balanced >= SPOOL_BALANCE) {
+            balanced = std::chrono::steady_clock::now();
+            if(spool.starving()) {
+                std::size_t half = todo.size() / 2;
+                for(std::size_t i = 0; i < half; ++i)
+                    hand_out(todo[i]);
+                todo.erase(todo.begin(), todo.begin() + half);
+            }
+        }
+        Pending next = std::move(todo.back());
+        todo.pop_back();
+        if(listed >= SPOOL_SPLIT) {
+            hand_out(next);
+            continue;
+        }
+        read_dir(next.dir, true, [&](const fs::path& p, const StatInfo& st) {
+            ++listed;
+            fs::path shown = next.shown / p.filename();
+            if(st.is_dir && !st.is_link && next.depth < t.maxdepth)
+                todo.push_back({p, shown, next.depth + 1});
+            if((st.is_dir && !t.dirs) || is_lockfile(shown) || !match_root(r, shown))
+                return;
+            ok = make_record(shown, st).write_utf8(out) && ok;
+        });
+    }
+    if(out)
+        ok = fclose(out) == 0 && ok;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        stop = true;
+    }
+    cv.notify_one();
+    heartbeat.join();
+    if(!ok && !lost)
+        std::wcerr << L"作業結果を書き込めませんでした `" << t.shown.c_str() << L"`" << std::endl;
+    /* done/ is written even after an error, otherwise the coordinator would wait forever.
+       a lost claim is refused here and its rows dropped: the task runs again elsewhere */
+    spool.finish(id, claim, sum.encode());
+}
+
+int run_worker(const wchar_t* dir) {
+    Spool spool(dir);
+    if(!spool.init(false)) {
+        std::wcerr << L"作業フォルダを使用できませんでした `" << dir << L"`" << std::endl;
+        return 1;
+    }
+    for(;;) {
+        std::string id, claim, payload;
+        if(spool.claim(id, claim, payload)) {
+            run_task(spool, id, claim, payload);
+            continue;
+        }
+        if(spool.finished())
+            return 0;
+        spool.requeue_stale();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+/*
+ * --spool coordinator: publishes the subdirectories of every root, works on tasks itself and merges the rows.
+ * A task only counts once the claim that published it is the one that finished its parent, so the
+ * tasks a worker published before its claim was taken back are dropped with it, subtree and all.
+ */
+bool collect_spool(const std::vector<wchar_t*>& roots, const ReportOptions& opt, const wchar_t* dir,
+                   ExternalSorter<FileRecord>& sorter) {
+    Spool spool(dir);
+    if(!spool.init(true)) {
+        std::wcerr << L"作業フォルダを使用できませんでした `" << dir << L"`" << std::endl;
+        return false;
+    }
+    uint64_t expected = 0, merged = 0;
+    bool ok = true;
+    for(auto a : roots) {
+        ScanRoot r;
+        if(!resolve_root(a, r))
+            return false;
+        if(r.is_file) {
+            StatInfo st;
+            if(stat_path(r.pattern, st, true))
+                ok = sorter.add(make_record(r.pattern, st)) && ok;
+            continue;
+        }
+        std::error_code ec;
+        fs::path abs = fs::absolute(r.dir, ec);
+        if(ec) {
+            std::wcerr << L"フォルダの絶対パスを取得できませんでした `" << r.dir.c_str() << L"`" << std::endl;
+            return false;
+        }
+        read_dir(r.dir, true, [&](const fs::path& p, const StatInfo& st) {
+            if(st.is_dir && !st.is_link && opt.maxdepth > 0) {
+                ScanTask t;
+                t.dir = abs / p.filename();
+                t.shown = p;
+                t.depth = 1;
+                t.maxdepth = opt.maxdepth;
+                t.dirs = opt.dirs;
+                t.is_wildcard = r.is_wildcard;
+                t.match = r.match;
+                if(spool.publish(spool.new_id(), t.encode()))
+                    ++expected;
+                else
+                    ok = false;
+            }
+            if((st.is_dir && !opt.dirs) || is_lockfile(p) || !match_root(r, p))
+                return;
+            ok = sorter.add(make_record(p, st)) && ok;
+        });
+    }
+
+    /* claim that finished each merged or dropped task; dropped ones map to "" */
+    std::unordered_map<std::string, std::string> claims;
+    while(merged < expected) {
+        bool busy = false;
+        for(auto& id : spool.done()) {
+            std::string s;
+            TaskSummary sum;
+            if(!spool.summary(id, s))
+                continue;
+            bool keep = true;
+            if(sum.decode(s) && !sum.parent.empty()) {
+                auto parent = claims.find(sum.parent);
+                if(parent == claims.end())
+                    continue; /* wait for the parent, which tells whether this task counts */
+                keep = parent->second == sum.parent_claim;
+            }
+            if(keep) {
+                FILE* fp = open_binary(spool.rows(id), false);
+                if(fp) {
+                    FileRecord rec;
+                    while(rec.read_utf8(fp))
+                        ok = sorter.add(std::move(rec)) && ok;
+                    fclose(fp);
+                }
+                expected += sum.spawned;
+                ++merged;
+            }
+            claims[id] = keep ? sum.claim : std::string();
+            spool.remove(id);
+            busy = true;
+        }
+        std::string id, claim, payload;
+        if(merged < expected && spool.claim(id, claim, payload)) {
+            run_task(spool, id, claim, payload);
+            busy = true;
+        }
+        if(!busy) {
+            spool.requeue_stale();
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+    spool.set_finished();
+    if(!ok)
+        std::wcerr << L"一時ファイルを書き込めませんでした。空き容量またはTEMPの設定を確認してください" << std::endl;
+    return ok;
+}
+
+/* depth of p below dir as recursive_directory_iterator counts it (direct children = 0), -1 when p is not below dir */
+int depth_below(const fs::path& dir, const fs::path& p) {
+    fs::path rel = p.lexically_relative(dir);
+    if(rel.empty() || rel == fs::path(L".") || *rel.begin() == fs::path(L".."))
+        return -1;
+    int depth = -1;
+    for(auto it = rel.begin(); it != rel.end(); ++it)
+        ++depth;
+    return depth;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    setlocale(LC_ALL, "");
+    std::locale::global(std::locale(""));
+
+    auto ap = ArgParser(L"指定したフォルダのパスの下にあるファイル・ディレクトリの一覧出力するプログラムです.\n", argc, argv);
+
+    bool header = true;
+    ap.add(L"-n", L"--noheader", &header, L"ヘッダを出力しない\n");
+
+    bool disp_dirs = false;
+    ap.add(L"-D", L"--directory", &disp_dirs, L"ディレクトリの詳細情報を出力する(デフォルトは出力しない)\n");
+
+    bool disp_files = true;
+    ap.add(L"-F", L"--file", &disp_files, L"ファイルの詳細情報を出力する(デフォルトは出力する)\n");
+
+    int maxdepth = INT_MAX;
+    ap.add(L"-x", L"--maxdepth", &maxdepth, L"再帰的に一覧表示する場合の最大何階層まで出力するかどうか (デフォルト無制限)\n");
+
+    wchar_t* sep = DEFAULT_SEPARATOR;
+    ap.add(L"-s", L"--sep", &sep, L"詳細情報の区切り文字、デフォルトはタブ文字\n");
+
+    bool follow_symlink = false;
+    ap.add(L"-l", L"--follow-symlink", &follow_symlink, L"リンク先パスを表示する。(注)少し処理が遅くなる");
+
+    int unit = KB;
+    wchar_t u = 'k';
+    ap.add(L"-u", L"--sizeunit", &u, L"ファイルサイズの表示単位\n"
+                  L"                          b : バイト\n"
+                  L"                          k : キロバイト(デフォルト)\n"
+                  L"                          m : メガバイト\n"
+                  L"                          g : ギガバイト\n");
+
+    wchar_t* display_order = DEFAULT_DISPLAYORDER;
+    ap.add(L"-d", L"--display", &display_order,
+                L"select display target categories. (default : display output all category)\n"
+                L"   p : permission       (ex. -rw-------)\n"
+                L"   u : owner user name  (ex. root)\n"
+                L"   g : owner group name (ex. root)\n"
+                L"   s : file size        (ex. 123456)\n"
+                L"   a : atime            (ex. 2022/02/05 10:00:00)\n"
+                L"   m : mtime            (ex. 2022/02/05 10:00:00)\n"
+                L"   c : ctime            (ex. 2022/02/05 10:00:00)\n"
+                L"   d : dirname          (ex. /root/.ssh)\n"
+                L"   b : filename          (ex. known_hosts)\n"
+                L"   f : fullpath         (ex. /root/.ssh/known_hosts)\n"
+                L"   h : content hash     (ex. 6c1b07bc7bbc4be347939ac4a93c437a, see --hash)\n"
+                L"   n : shortcut share   (ex. \\\\server\\share)\n"
+                L"   w : shortcut workdir (ex. C:\\work)\n"
+                L"   r : shortcut args    (ex. -x 1)\n"
+                L"   e : shortcut comment\n"
+                L"   t : content type     (ex. ZIP, OOXML, LNK, PNG, UTF-8. from the first 512 bytes)\n"
+                L"  Example: --display psmbdf\n"
+                L"  Output-> -rw-------  root root 123456 2022/02/05 10:00:00 /root/.ssh/known_hosts\n");
+
+    wchar_t* format = DATETIME_FORMAT;
+    ap.add(L"-f", L"--format-time", &format,
+                L"output timeformat string. (default %Y/%m/%d_%H:%M:%S)\n"
+                L"see format definition.\n"
+                L"https://www.cplusplus.com/reference/ctime/strftime/\n");
+
+    int jobs = 0;
+    ap.add(L"-j", L"--jobs", &jobs, L"集計モードで並列に走査する、または --display h でハッシュを計算するスレッド数 (デフォルトはCPU数)\n");
+
+    bool aggregate = false;
+    ap.add(L"-A", L"--aggregate", &aggregate,
+                L"ファイル毎ではなくフォルダ毎に集計して出力する (du相当)\n"
+                L"   サイズ・割当サイズ・ファイル数・フォルダ数・最終更新日時をサブフォルダ込みで集計\n"
+                L"   ハードリンクは1回だけ数える。出力する階層は -x で指定\n");
+
+    int topn = 0;
+    ap.add(L"-T", L"--top", &topn, L"サイズが大きい順(または日時が古い順)に上位N件のファイルだけを出力する\n");
+
+    wchar_t* by = (wchar_t*)L"size";
+    ap.add(L"-B", L"--by", &by,
+                L"--top の並び順\n"
+                L"   size  : ファイルサイズが大きい順(デフォルト)\n"
+                L"   mtime : 更新日時が古い順\n"
+                L"   atime : アクセス日時が古い順\n");
+
+    wchar_t* group_by = NULL;
+    ap.add(L"-G", L"--group-by", &group_by,
+                L"一覧ではなくグループ毎の件数・合計/最小/最大サイズ・最古/最新更新日時を出力する\n"
+                L"   ext        : 拡張子\n"
+                L"   uid        : 所有ユーザID\n"
+                L"   gid        : 所有グループID\n"
+                L"   depthN     : 先頭からN階層目までのフォルダ (ex. depth1)\n"
+                L"   age-bucket : 更新日時の経過期間 (--age-buckets の区間)\n"
+                L"   type       : 種類 (DIR/LINK/FILE, DIRは-D指定時のみ)\n");
+
+    wchar_t* histogram = NULL;
+    ap.add(L"-H", L"--histogram", &histogram,
+                L"一覧ではなく分布(件数・合計サイズ・割合)を出力する\n"
+                L"   size  : ファイルサイズ (2のべき乗毎の区間)\n"
+                L"   mtime : 更新日時の経過期間 (--age-buckets の区間)\n"
+                L"   atime : アクセス日時の経過期間 (--age-buckets の区間)\n");
+
+    bool histogram_bar = false;
+    ap.add(NULL, L"--bar", &histogram_bar, L"--histogram の結果に * のグラフ列を追加する\n");
+
+    wchar_t* age_buckets = NULL;
+    ap.add(NULL, L"--age-buckets", &age_buckets,
+                L"経過期間の区間をカンマ区切りで指定する (デフォルト 1d,7d,30d,1y)\n"
+                L"   単位 h:時間 d:日 w:週 m:30日 y:365日\n");
+
+    bool duplicates = false;
+    ap.add(NULL, L"--duplicates", &duplicates,
+                L"内容が同じファイルをグループ毎に出力する\n"
+                L"   サイズが同じファイルだけ先頭/末尾64KBのハッシュを取り、それも一致したものだけ全体を読む\n"
+                L"   ハードリンクは1つとして扱う\n");
+
+    wchar_t* hash = (wchar_t*)L"fast";
+    ap.add(NULL, L"--hash", &hash,
+                L"--display h で出力するハッシュの種類\n"
+                L"   fast   : MurmurHash3 128bit (デフォルト)\n"
+                L"   sha256 : SHA-256\n");
+
+    wchar_t* sort_by = NULL;
+    ap.add(NULL, L"--sort", &sort_by,
+                L"一覧を並べ替えて出力する\n"
+                L"   size  : ファイルサイズ順\n"
+                L"   mtime : 更新日時順\n"
+                L"   name  : ファイル名順\n"
+                L"   path  : フルパス順\n");
+
+    bool reverse = false;
+    ap.add(NULL, L"--reverse", &reverse, L"--sort の並び順を逆(降順)にする\n");
+
+    wchar_t* sort_mem = (wchar_t*)L"256M";
+    ap.add(NULL, L"--sort-mem", &sort_mem,
+                L"--sort, --snapshot, --diff でメモリ上に保持する上限 (デフォルト 256M)\n"
+                L"   超えた分は一時フォルダに書き出して最後にマージする\n");
+
+    wchar_t* snapshot = NULL;
+    ap.add(NULL, L"--snapshot", &snapshot,
+                L"走査結果をパス順のバイナリ索引(パス・サイズ・更新日時・属性・inode)としてファイルに保存する\n");
+
+    wchar_t* diff = NULL;
+    ap.add(NULL, L"--diff", &diff,
+                L"--snapshot で保存したファイルと今回の走査結果を比較し、追加・削除・変更されたものだけを出力する\n"
+                L"   --snapshot と同時に指定すると比較しながら新しいスナップショットを保存する\n");
+
+    wchar_t* state = NULL;
+    ap.add(NULL, L"--state", &state,
+                L"フォルダ毎の更新日時と中身を保存するファイル。次回は更新日時が変わったフォルダだけを読み直す\n"
+                L"   (注)フォルダの更新日時が変わらない変更(既存ファイルの上書き等)は次に読み直すまで反映されない\n");
+
+    wchar_t* verify_interval = NULL;
+    ap.add(NULL, L"--verify-interval", &verify_interval,
+                L"--state で、前回読んでからこの期間が過ぎたフォルダは変更がなくても読み直す (ex. 7d)\n"
+                L"   単位 h:時間 d:日 w:週 m:30日 y:365日 (デフォルトは読み直さない)\n");
+
+    bool watch = false;
+    ap.add(NULL, L"--watch", &watch,
+                L"一覧を出力した後も終了せず、作成・変更・削除をイベント列付きの行として出力し続ける\n"
+                L"   イベント LIST:一覧 CREATE:作成 MODIFY:変更 DELETE:削除\n"
+                L"   RESCAN:変更を取りこぼしたフォルダ。その配下を捨てて、続くLIST行で置き換える\n");
+
+    wchar_t* stat_cache_file = NULL;
+    ap.add(NULL, L"--stat-cache", &stat_cache_file,
+                L"ファイルのstat結果をキャッシュするファイル。2回目以降はフォルダを1回statするだけで中のファイルはキャッシュから出力する\n"
+                L"   複数のlsdirから同時に使用できる。(注)フォルダの更新日時が変わらない変更(既存ファイルの上書き等)は反映されない\n");
+
+    wchar_t* lnk_cache_file = NULL;
+    ap.add(NULL, L"--lnk-cache", &lnk_cache_file,
+                L"-l のリンク先と n,w,r,e 列をキャッシュするファイル。パス・サイズ・更新日時が同じショートカットは開かずに出力する\n"
+                L"   複数のlsdirから同時に使用できる\n");
+
+    wchar_t* spool_dir = NULL;
+    ap.add(NULL, L"--spool", &spool_dir,
+                L"複数プロセス(複数ホスト)で分担して走査する。指定フォルダを作業キューとして使う\n"
+                L"   --worker なし : コーディネータ。最上位のサブフォルダを作業として登録し、自分も走査しながら結果をまとめて出力する\n"
+                L"   --worker あり : ワーカー。作業を取って走査し、結果をバイナリで書き戻す (コーディネータより後に起動する)\n"
+                L"   大きいサブフォルダは走査中に分割して他のワーカーに渡す\n");
+
+    bool worker = false;
+    ap.add(NULL, L"--worker", &worker, L"--spool のワーカーとして動作する。コーディネータが終わると終了する\n");
+
+    wchar_t* merkle = NULL;
+    ap.add(NULL, L"--merkle", &merkle,
+                L"フォルダ毎に配下の名前・サイズ・更新日時・種類から計算したハッシュをファイルに保存し、ルートのハッシュを出力する\n");
+
+    wchar_t* merkle_diff = NULL;
+    ap.add(NULL, L"--merkle-diff", &merkle_diff,
+                L"--merkle で保存したファイルと、指定フォルダ(または別の--merkleファイル)を比較する\n"
+                L"   ハッシュが違うフォルダにだけ降りていき、追加・削除・変更(直下のファイルが違う)フォルダを出力する\n");
+
+    bool compare = false;
+    ap.add(NULL, L"--compare", &compare,
+                L"2つのフォルダ A B を同時にたどって比較し、違いだけを出力する\n"
+                L"   欠落(Aにだけある)、余分(Bにだけある)、変更(サイズ・更新日時・種類が違う)\n");
+
+    wchar_t* relink = NULL;
+    ap.add(NULL, L"--relink", &relink,
+                L"配下のショートカットのリンク先・作業フォルダの文字列を置換して書き換える。 置換前=置換後 の形式で指定\n"
+                L"   例) --relink \\\\oldsrv\\share=\\\\newsrv\\share  一時ファイルに書いてから置き換える。一致しないものは書き換えない\n");
+
+    bool dry_run = false;
+    ap.add(NULL, L"--dry-run", &dry_run, L"--relink で書き換えずに、変更予定の一覧だけを出力する\n");
+
+    bool merkle_content = false;
+    ap.add(NULL, L"--merkle-content", &merkle_content, L"--merkle のハッシュにファイルの内容も含める (全ファイルを読む)\n");
+
+    bool check_targets = false;
+    ap.add(NULL, L"--check-targets", &check_targets,
+                L"ショートカットとシンボリックリンクのリンク先が存在するかを列に出力する\n"
+                L"   OK:存在する MISSING:存在しない UNREACHABLE:読めない・応答がない\n"
+                L"   リンク先のフォルダ毎に1回だけ一覧を取って判定する\n");
+
+    bool canonical = false;
+    ap.add(NULL, L"--canonical", &canonical,
+                L"-l でシンボリックリンクのリンク先を、途中のリンクもすべてたどった最終的なパスで表示する\n"
+                L"   同じ中間フォルダを通るリンクは1回だけ解決する\n");
+
+    bool into_archives = false;
+    ap.add(NULL, L"--into-archives", &into_archives,
+                L"zipとtar(無圧縮)の中身も 書庫のパス!/中のパス の行として書庫の行の後に出力する\n"
+                L"   zipは末尾の中央ディレクトリだけ、tarは各ファイルのヘッダだけを読み、展開はしない\n"
+                L"   サイズは展開後のサイズ。書庫の中のフォルダは -D 指定時のみ\n");
+
+    int check_timeout = 5;
+    ap.add(NULL, L"--check-timeout", &check_timeout,
+                L"--check-targets でネットワーク上(\\\\server)のリンク先を待つ秒数 (デフォルト 5)\n"
+                L"   応答がないサーバは以降 UNREACHABLE とする\n");
+    ap.parse();
+
+    if(worker) {
+        if(!spool_dir) {
+            std::wcerr << L"--workerには--spoolの指定が必要です" << std::endl;
+            return 1;
+        }
+        return run_worker(spool_dir);
+    }
+
+    switch(u) {
+        case 'b':
+        case 'B':
+            unit = B;
+            break;
+        case 'k':
+        case 'K':
+            break;
+        case 'm':
+        case 'M':
+            unit = MB;
+            break;
+
+        case 'g':
+        case 'G':
+            unit = GB;
+            break;
+        default:
+            std::wcerr << L"sizeunitの指定値が不明です。-hでヘルプを参照して正しい値を指定してください" << std::endl;
+            return 1;
+    }
+
+    if(ap.positional_argv.size() == 0)
+        ap.positional_argv.push_back(L".");
+
+    ReportOptions opt;
+    opt.display_order = display_order;
+    opt.sep = sep;
+    opt.format = format;
+    opt.unit = unit;
+    opt.maxdepth = maxdepth;
+    opt.jobs = jobs < 0 ? 0 : (unsigned)jobs;
+    opt.header = header;
+    opt.follow_symlink = follow_symlink;
+    opt.dirs = disp_dirs;
+    AgeBuckets ages;
+    if(age_buckets && !ages.parse(age_buckets)) {
+        std::wcerr << L"--age-bucketsの指定値が不正です。(ex. 1d,7d,30d,1y)" << std::endl;
+        return 1;
+    }
+
+    if(aggregate)
+        return print_aggregate(ap.positional_argv, opt);
+    if(topn > 0)
+        return print_top(ap.positional_argv, opt, topn, by);
+    if(group_by)
+        return print_group_by(ap.positional_argv, opt, group_by, ages);
+    if(histogram)
+        return print_histogram(ap.positional_argv, opt, histogram, ages, histogram_bar);
+    if(duplicates)
+        return print_duplicates(ap.positional_argv, opt);
+    if(compare)
+        return print_compare(ap.positional_argv, opt);
+    if(relink)
+        return run_relink(ap.positional_argv, opt, relink, dry_run);
+    if(merkle || merkle_diff)
+        return run_merkle(ap.positional_argv, opt, merkle, merkle_diff, merkle_content);
+
+    bool sha256 = wcscmp(hash, L"sha256") == 0;
+    if(!sha256 && wcscmp(hash, L"fast") != 0) {
+        std::wcerr << L"--hashの指定値が不明です。fast, sha256 のいずれかを指定してください" << std::endl;
+        return 1;
+    }
+
+    uint64_t budget = parse_bytes(sort_mem);
+    if(budget == 0) {
+        std::wcerr << L"--sort-memの指定値が不正です。(ex. 256M)" << std::endl;
+        return 1;
+    }
+    std::unique_ptr<DirStateCache> cache;
+    if(state) {
+        cache.reset(new DirStateCache());
+        if(verify_interval && !parse_duration(verify_interval, cache->verify_interval)) {
+            std::wcerr << L"--verify-intervalの指定値が不正です。(ex. 7d)" << std::endl;
+            return 1;
+        }
+        if(!cache->load(state)) {
+            std::wcerr << L"状態ファイルを読み込めませんでした `" << state << L"`" << std::endl;
+            return 1;
+        }
+    }
+    auto save_state = [&]() {
+        if(cache && !cache->save(state)) {
+            std::wcerr << L"状態ファイルを書き込めませんでした `" << state << L"`" << std::endl;
+            return 1;
+        }
+        return 0;
+    };
+
+    /* the walkers that fill a sorter directly: --spool workers, or the parallel walk (with --state) */
+    Collector collect = [&](ExternalSorter<FileRecord>& s) {
+        if(spool_dir)
+            return collect_spool(ap.positional_argv, opt, spool_dir, s);
+        return collect_records(ap.positional_argv, opt, s, cache.get());
+    };
+
+    if(snapshot || diff) {
+        int ret = run_snapshot(opt, snapshot, diff, (std::size_t)budget, collect);
+        return ret ? ret : save_state();
+    }
+
+    std::unique_ptr<ExternalSorter<FileRecord>> sorter;
+    if(sort_by || cache || spool_dir) {
+        /* those walks are parallel, so their rows are put in path order unless --sort says otherwise */
+        auto less = record_order(sort_by ? sort_by : L"path", reverse);
+        if(!less) {
+            std::wcerr << L"--sortの指定値が不明です。size, mtime, name, path のいずれかを指定してください" << std::endl;
+            return 1;
+        }
+        sorter.reset(new ExternalSorter<FileRecord>(less, (std::size_t)budget));
+    }
+
+    std::unique_ptr<StatCache> stat_cache;
+    if(stat_cache_file) {
+        stat_cache.reset(new StatCache());
+        if(!stat_cache->open(stat_cache_file)) {
+            std::wcerr << L"statキャッシュファイルを開けませんでした `" << stat_cache_file << L"`" << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<LnkCache> lnk_cache;
+    if(lnk_cache_file) {
+        lnk_cache.reset(new LnkCache());
+        if(!lnk_cache->open(lnk_cache_file)) {
+            std::wcerr << L"ショートカットキャッシュファイルを開けませんでした `" << lnk_cache_file << L"`" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<ScanRoot> scan_roots(ap.positional_argv.size());
+    for(std::size_t i = 0; i < scan_roots.size(); ++i) {
+        if(!resolve_root(ap.positional_argv[i], scan_roots[i]))
+            return 1;
+    }
+
+    /* watches are set up before the initial listing so that nothing changed during it is missed */
+    EventQueue events;
+    std::unique_ptr<Watcher> watcher;
+    if(watch) {
+        if(!Watcher::supported()) {
+            std::wcerr << L"--watchはこのOSでは使用できません" << std::endl;
+            return 1;
+        }
+        watcher.reset(new Watcher(events));
+        for(auto& r : scan_roots) {
+            if(!watcher->add(r.is_file ? r.pattern.parent_path() : r.dir)) {
+                std::wcerr << L"変更の監視を開始できませんでした `" << (r.is_file ? r.pattern : r.dir).c_str() << L"`" << std::endl;
+                return 1;
+            }
+        }
+    }
+    /* with --watch every row starts with an event column. rows that just list what exists are LIST */
+    const wchar_t* row_event = L"LIST";
+
+    if(header) {
+        FileInfo fp(".");
+        if(watch)
+            wprintf(L"%s%s", L"イベント", sep);
+        fp.print_header(display_order, sep, unit, follow_symlink, check_targets);
+    }
+
+    /*
+     * with the h column, -l or a shortcut column, files are read on a separate pool and rows still come
+     * out in walk order. rows with nothing to read only wait for their turn; shortcuts of one directory
+     * go as one batch. a shortcut column parses the whole shortcut once, -l alone only its target.
+     * --check-targets looks at every row, since only lstat tells a symlink apart. the t column reads
+     * one block of each file, so those reads are batched per directory like shortcuts. each archive
+     * of --into-archives is a task of its own and its members are printed right after it
+     */
+    std::unique_ptr<OrderedPipeline<PendingRow>> pipeline;
+    std::vector<std::vector<unsigned char>> hash_bufs;
+    bool hash_column = wcschr(display_order, L'h') != NULL;
+    bool lnk_columns = wcspbrk(display_order, L"nwre") != NULL;
+    bool type_column = wcschr(display_order, L't') != NULL;
+    std::unique_ptr<TargetChecker> checker;
+    if(check_targets)
+        checker.reset(new TargetChecker(check_timeout));
+    std::unique_ptr<LinkResolver> resolver;
+    if(canonical)
+        resolver.reset(new LinkResolver());
+    fs::path batch_dir;
+    auto print_row = [&](FileInfo& fp) {
+        if(watch)
+            wprintf(L"%s%s", row_event, sep);
+        fp.print_info(display_order, sep, format, unit, follow_symlink, check_targets);
+    };
+    if(hash_column || follow_symlink || lnk_columns || type_column || checker || into_archives) {
+        pipeline.reset(new OrderedPipeline<PendingRow>(
+            opt.jobs, ROW_WINDOW,
+            [&](unsigned tid, PendingRow& row) {
+                if(hash_column && (row.st.st_mode & _S_IFREG))
+                    hash_row(row, sha256, hash_bufs[tid]);
+                if(type_column && (row.st.st_mode & _S_IFREG))
+                    row.file_type = sniff_file(row.path);
+                if(into_archives && (row.st.st_mode & _S_IFREG) && is_archive(row.path))
+                    archive_rows(row.path, disp_dirs, row.inner);
+                bool lnk = is_shortcut(row.path);
+                if(lnk && lnk_cache && (lnk_columns || follow_symlink || checker))
+                    lnk_cache->details(row.path, row.st, row.lnk);
+                else if(lnk && lnk_columns)
+                    LnkTarget().read_details(row.path, row.lnk);
+                else if(lnk && (follow_symlink || checker))
+                    row.lnk.target = shortcut_target(row.path);
+                if(follow_symlink || checker) {
+                    std::error_code ec;
+                    if(row.link < 0)
+                        row.link = fs::is_symlink(fs::symlink_status(row.path, ec)) ? 1 : 0;
+                    if(row.link == 1)
+                        row.link_path = resolver ? resolver->resolve(row.path) : fs::read_symlink(row.path, ec);
+                }
+                if(checker)
+                    row.target_state = TargetChecker::name(
+                        checker->check(TargetChecker::link_target(row.path, row.lnk.target, row.link_path)));
+            },
+            [&](PendingRow& row) {
+                FileInfo fp(row.path, row.st);
+                fp.digest = std::move(row.digest);
+                fp.lnk = std::move(row.lnk);
+                fp.lnk_resolved = true;
+                fp.target_state = row.target_state;
+                fp.link = row.link;
+                fp.link_path = std::move(row.link_path);
+                fp.file_type = row.file_type;
+                print_row(fp);
+                for(auto& r : row.inner) {
+                    /* members have no file of their own: nothing to resolve or read */
+                    FileInfo m(r.path, r.st);
+                    m.lnk_resolved = true;
+                    m.link = 0;
+                    m.file_type = L"";
+                    print_row(m);
+                }
+            },
+            hash_column ? 1 : LNK_BATCH));
+        hash_bufs.resize(pipeline->threads());
+    }
+    /* link is 1 for a symlink, 0 otherwise, -1 when the caller did not find out */
+    auto emit = [&](const fs::path& p, const struct _stat& st, int link) {
+        if(pipeline) {
+            bool archive = into_archives && (st.st_mode & _S_IFREG) && is_archive(p);
+            bool work = (hash_column && (st.st_mode & _S_IFREG)) || ((follow_symlink || lnk_columns) && is_shortcut(p)) ||
+                        (follow_symlink && link != 0) || (type_column && (st.st_mode & _S_IFREG)) || checker || archive;
+            if(work && !hash_column) {
+                fs::path dir = p.parent_path();
+                if(dir != batch_dir) {
+                    pipeline->flush();
+                    batch_dir = std::move(dir);
+                }
+            }
+            pipeline->push({p, st, std::string(), LnkDetails(), L"", link, fs::path(), NULL, std::vector<InnerRow>()}, work);
+            if(archive)
+                pipeline->flush();
+            return;
+        }
+        FileInfo fp(p, st);
+        fp.link = link;
+        print_row(fp);
+    };
+    /* each entry is stat'ed once here. with --sort it is kept as a binary record until the final emit */
+    bool sort_ok = true;
+    auto list = [&](const fs::path& p, int link) {
+        struct _stat st = {0};
+        if(stat_cache)
+            stat_cache->stat(p, st);
+        else
+            _wstat(p.c_str(), &st);
+        if(sorter)
+            sort_ok = sorter->add(make_record(p, st)) && sort_ok;
+        else
+            emit(p, st, link);
+    };
+    /* lists dir below root r. base is the depth of dir's own entries below r.dir */
+    auto walk = [&](const ScanRoot& r, const fs::path& dir, int base, const std::function<void(const fs::path&, int)>& f) {
+        std::error_code ec;
+        for(auto entry = fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied, ec),
+                 last = fs::recursive_directory_iterator();
+            entry != last; ++entry) {
+            if(entry->is_directory()) {
+                if(base + entry.depth() > maxdepth)
+                    break;
+                if(!disp_dirs)
+                    continue;
+            }
+            auto epth = entry->path();
+            if(is_lockfile(epth))
+                continue;
+
+            if(!match_root(r, epth))
+                continue;
+
+            f(epth, entry->is_symlink(ec) ? 1 : 0); /* from d_type, no extra stat */
+        }
+    };
+
+    if(cache || spool_dir) {
+        if(!collect(*sorter))
+            return 1;
+    } else {
+        for(auto& r : scan_roots) {
+            if(r.is_file)
+                list(r.pattern, -1);
+            else
+                walk(r, r.dir, 0, list);
+        }
+    }
+    if(sorter) {
+        sort_ok = sort_ok && sorter->drain([&](const FileRecord& rec) { emit(fs::path(rec.path), record_stat(rec), -1); });
+        if(!sort_ok) {
+            std::wcerr << L"--sortの一時ファイルを書き込めませんでした。空き容量またはTEMPの設定を確認してください" << std::endl;
+            return 1;
+        }
+    }
+    if(pipeline)
+        pipeline->finish();
+    int ret = save_state();
+    if(!watcher || ret)
+        return ret;
+
+    /* --watch: stream changes until killed. events bypass --sort and --state */
+    auto emit_now = [&](const wchar_t* event, const fs::path& p, const struct _stat& st) {
+        row_event = event;
+        emit(p, st, -1);
+        if(pipeline)
+            pipeline->finish();
+    };
+    auto stat_now = [&](const wchar_t* event, const fs::path& p) {
+        struct _stat st;
+        if(_wstat(p.c_str(), &st) == 0)
+            emit_now(event, p, st);
+    };
+    for(fflush(stdout);; fflush(stdout)) {
+        WatchEvent ev = events.pop();
+        for(auto& r : scan_roots) {
+            if(r.is_file) {
+                if(ev.path == r.pattern || (ev.kind == WatchEvent::RESCAN && (ev.path.empty() || ev.path == r.pattern.parent_path()))) {
+                    struct _stat st = {0};
+                    if(ev.kind == WatchEvent::DELETE || _wstat(r.pattern.c_str(), &st) == 0)
+                        emit_now(ev.kind == WatchEvent::RESCAN ? L"LIST" : event_name(ev.kind), r.pattern, st);
+                }
+                continue;
+            }
+
+            if(ev.kind == WatchEvent::RESCAN) {
+                /* consumers drop what they know below a RESCAN row; the LIST rows that follow are what exists now */
+                fs::path dir = ev.path.empty() ? r.dir : ev.path;
+                int depth = dir == r.dir ? -1 : depth_below(r.dir, dir);
+                if(dir != r.dir && depth < 0)
+                    continue;
+                struct _stat st = {0};
+                _wstat(dir.c_str(), &st);
+                emit_now(L"RESCAN", dir, st);
+                if(depth < maxdepth)
+                    walk(r, dir, depth + 1, [&](const fs::path& p, int) { stat_now(L"LIST", p); });
+                continue;
+            }
+
+            int depth = depth_below(r.dir, ev.path);
+            if(depth < 0 || depth > maxdepth || is_lockfile(ev.path) || !match_root(r, ev.path))
+                continue;
+            if(ev.kind == WatchEvent::DELETE) {
+                struct _stat st = {0};
+                emit_now(L"DELETE", ev.path, st);
+                continue;
+            }
+            struct _stat st;
+            if(_wstat(ev.path.c_str(), &st) != 0)
+                continue; /* already gone, a DELETE follows */
+            bool is_dir = (st.st_mode & _S_IFDIR) != 0;
+            if(!is_dir || disp_dirs)
+                emit_now(event_name(ev.kind), ev.path, st);
+            /* a directory created or moved in arrives as one event; its contents are listed here */
+            if(is_dir && ev.kind == WatchEvent::CREATE && depth < maxdepth)
+                walk(r, ev.path, depth + 1, [&](const fs::path& p, int) { stat_now(L"CREATE", p); });
         }
     }
-    return 0;
 }
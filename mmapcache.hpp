@@ -0,0 +1,271 @@
+/* mmapcache.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _MMAPCACHE_HPP_
+#define _MMAPCACHE_HPP_
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Fixed size open-addressing hash table in a memory-mapped file, shared by every process that
+ * opens the same file. Keys are 128bit (k1, k2); Value must be trivially copyable.
+ * Each slot is guarded by a sequence lock: writers make the counter odd while they copy and readers
+ * check it did not move while they copied, so a torn read is a miss, never a wrong value.
+ * It is a cache: a full probe window evicts, and lost races simply drop the write.
+ */
+template <typename Value>
+class MmapTable {
+    static_assert(std::is_trivially_copyable<Value>::value, "Value is copied byte-wise into shared memory");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "slots are shared between processes");
+
+   public:
+    static const uint32_t PROBES = 8;
+
+    MmapTable() : base(NULL), bytes(0), slots(NULL), mask(0) {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        fd = -1;
+#endif
+    }
+    MmapTable(const MmapTable&) = delete;
+    MmapTable& operator=(const MmapTable&) = delete;
+    ~MmapTable() { close(); }
+
+    bool is_open() const { return slots != NULL; }
+
+    /*
+     * opens or creates the table. capacity (rounded up to a power of two) only applies to a new file.
+     * Only a file this call created, or an empty one, is sized and given a header: any other file
+     * must already carry this magic and layout, and is refused untouched otherwise.
+     */
+    bool open(const std::filesystem::path& p, uint32_t magic, std::size_t capacity = 1 << 20) {
+        close();
+        std::size_t n = 1024;
+        while(n < capacity)
+            n <<= 1;
+        std::size_t want = sizeof(Header) + n * sizeof(Slot);
+        bool fresh = false;
+        if(!map(p, want, magic, fresh))
+            return false;
+
+        Header* h = (Header*)base;
+        uint32_t expect = 0;
+        if(fresh && h->magic.compare_exchange_strong(expect, BUSY)) {
+            h->value_size = (uint32_t)sizeof(Value);
+            h->slot_count = (uint64_t)((bytes - sizeof(Header)) / sizeof(Slot));
+            h->magic.store(magic, std::memory_order_release);
+            expect = magic;
+        }
+        /* another process may still be writing the header */
+        for(int i = 0; i < 1000 && (expect == BUSY || expect == 0); ++i) {
+            std::this_thread::yield();
+            expect = h->magic.load(std::memory_order_acquire);
+        }
+        if(!valid(expect, h->value_size, h->slot_count, magic, bytes)) {
+            close();
+            return false;
+        }
+        slots = (Slot*)(base + sizeof(Header));
+        mask = h->slot_count - 1;
+        return true;
+    }
+
+    bool find(uint64_t k1, uint64_t k2, Value& out) const {
+        if(!slots)
+            return false;
+        for(uint32_t i = 0; i < PROBES; ++i) {
+            const Slot& s = slots[(k1 + i) & mask];
+            uint32_t seq = s.seq.load(std::memory_order_acquire);
+            if(seq & 1)
+                continue;
+            if(seq == 0)
+                return false; /* never written: the probe chain ends here */
+            uint64_t a = s.k1, b = s.k2;
+            Value v;
+            memcpy(&v, (const void*)&s.value, sizeof(Value));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(s.seq.load(std::memory_order_relaxed) != seq)
+                continue;
+            if(a == k1 && b == k2) {
+                out = v;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(uint64_t k1, uint64_t k2, const Value& v) {
+        if(!slots)
+            return;
+        /* reuse the key's own slot, else the first free one, else evict the home slot */
+        Slot* target = NULL;
+        for(uint32_t i = 0; i < PROBES && !target; ++i) {
+            Slot& s = slots[(k1 + i) & mask];
+            uint32_t seq = s.seq.load(std::memory_order_acquire);
+            if(seq == 0 || (!(seq & 1) && s.k1 == k1 && s.k2 == k2))
+                target = &s;
+        }
+        if(!target)
+            target = &slots[k1 & mask];
+        uint32_t seq = target->seq.load(std::memory_order_relaxed);
+        if((seq & 1) || !target->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+            return; /* another writer owns the slot */
+        std::atomic_thread_fence(std::memory_order_release);
+        target->k1 = k1;
+        target->k2 = k2;
+        memcpy((void*)&target->value, &v, sizeof(Value));
+        target->seq.store(seq + 2, std::memory_order_release);
+    }
+
+    void close() {
+#ifdef _WIN32
+        if(base)
+            UnmapViewOfFile(base);
+        if(mapping)
+            CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        if(base)
+            munmap(base, bytes);
+        if(fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        base = NULL;
+        slots = NULL;
+        bytes = 0;
+    }
+
+   private:
+    static const uint32_t BUSY = 1;
+
+    struct Header {
+        std::atomic<uint32_t> magic;
+        uint32_t value_size;
+        uint64_t slot_count;
+        char reserved[48];
+    };
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> seq; /* 0 = never used, odd = being written */
+        uint64_t k1;
+        uint64_t k2;
+        Value value;
+    };
+
+    static bool valid(uint32_t m, uint32_t value_size, uint64_t count, uint32_t magic, std::size_t size) {
+        return m == magic && value_size == sizeof(Value) && count != 0 && (count & (count - 1)) == 0 &&
+               count <= (size - sizeof(Header)) / sizeof(Slot);
+    }
+
+    /*
+     * an existing file's header, read before anything is mapped. a creator that has just sized the
+     * file writes its header right after, so an all-zero first word is waited on for a moment
+     */
+    template <typename ReadAt>
+    static bool check_header(ReadAt read_at, uint32_t magic, std::size_t size) {
+        if(size < sizeof(Header) + sizeof(Slot))
+            return false;
+        unsigned char raw[16];
+        uint32_t m = 0, value_size = 0;
+        uint64_t count = 0;
+        for(int i = 0; i < 1000; ++i) {
+            if(!read_at(raw, sizeof(raw)))
+                return false;
+            memcpy(&m, raw, 4);
+            if(m != 0 && m != BUSY)
+                break;
+            std::this_thread::yield();
+        }
+        memcpy(&value_size, raw + 4, 4);
+        memcpy(&count, raw + 8, 8);
+        return valid(m, value_size, count, magic, size);
+    }
+
+    /*
+     * maps the table file. a new or empty file is grown to want bytes and reported as fresh; an
+     * existing one is mapped at its own size, and only after its header matched
+     */
+    bool map(const std::filesystem::path& p, std::size_t want, uint32_t magic, bool& fresh) {
+#ifdef _WIN32
+        file = CreateFileW(p.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_NEW,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_EXISTS)
+            file = CreateFileW(p.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER sz;
+        if(!GetFileSizeEx(file, &sz))
+            return false;
+        fresh = sz.QuadPart == 0;
+        HANDLE f = file;
+        auto read_at = [f](unsigned char* dst, DWORD n) {
+            OVERLAPPED at = {};
+            DWORD got = 0;
+            return ReadFile(f, dst, n, &got, &at) && got == n;
+        };
+        if(!fresh && !check_header(read_at, magic, (std::size_t)sz.QuadPart))
+            return false;
+        /* a mapping larger than the file grows it; that only happens for a fresh one */
+        bytes = fresh ? want : (std::size_t)sz.QuadPart;
+        mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes, NULL);
+        if(mapping == NULL)
+            return false;
+        base = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+#else
+        fd = ::open(p.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(fd < 0 && errno == EEXIST)
+            fd = ::open(p.c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return false;
+        fresh = st.st_size == 0;
+        int f = fd;
+        auto read_at = [f](unsigned char* dst, std::size_t n) { return pread(f, dst, n, 0) == (ssize_t)n; };
+        if(!fresh && !check_header(read_at, magic, (std::size_t)st.st_size))
+            return false;
+        bytes = fresh ? want : (std::size_t)st.st_size;
+        if(fresh && ftruncate(fd, (off_t)bytes) != 0)
+            return false;
+        void* m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        base = m == MAP_FAILED ? NULL : (char*)m;
+#endif
+        return base != NULL;
+    }
+
+    char* base;
+    std::size_t bytes;
+    Slot* slots;
+    uint64_t mask;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+#endif /* _MMAPCACHE_HPP_ */
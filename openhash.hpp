@@ -0,0 +1,112 @@
+/* openhash.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _OPENHASH_HPP_
+#define _OPENHASH_HPP_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * String keyed hash map with open addressing (linear probing).
+ * Lookups of an existing key never allocate, so callers can build keys in a reused buffer.
+ * Not thread safe: keep one map per thread and merge() them at the end.
+ */
+template <typename Key, typename Value>
+class OpenHashMap {
+   public:
+    explicit OpenHashMap(std::size_t capacity = 64) : used(0) { slots.resize(round_up(capacity)); }
+
+    std::size_t size() const { return used; }
+
+    Value& operator[](const Key& key) {
+        if((used + 1) * 10 > slots.size() * 7)
+            grow();
+        uint64_t h = hash(key);
+        std::size_t mask = slots.size() - 1;
+        for(std::size_t i = (std::size_t)h & mask;; i = (i + 1) & mask) {
+            Slot& s = slots[i];
+            if(!s.used) {
+                s.used = true;
+                s.hash = h;
+                s.key = key;
+                ++used;
+                return s.value;
+            }
+            if(s.hash == h && s.key == key)
+                return s.value;
+        }
+    }
+
+    /* NULL when key is absent. never inserts, so concurrent finds on an unchanging map are safe */
+    const Value* find(const Key& key) const {
+        uint64_t h = hash(key);
+        std::size_t mask = slots.size() - 1;
+        for(std::size_t i = (std::size_t)h & mask;; i = (i + 1) & mask) {
+            const Slot& s = slots[i];
+            if(!s.used)
+                return NULL;
+            if(s.hash == h && s.key == key)
+                return &s.value;
+        }
+    }
+    Value* find(const Key& key) { return const_cast<Value*>(static_cast<const OpenHashMap*>(this)->find(key)); }
+
+    /* f(const Key&, Value&) for every entry, in no particular order */
+    template <typename F>
+    void for_each(F&& f) {
+        for(auto& s : slots) {
+            if(s.used)
+                f(s.key, s.value);
+        }
+    }
+
+    /* m(Value& into, const Value& from) is called for keys present in both maps */
+    template <typename M>
+    void merge(OpenHashMap& other, M&& m) {
+        other.for_each([&](const Key& k, Value& v) { m((*this)[k], v); });
+    }
+
+    static uint64_t hash(const Key& key) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for(auto c : key) {
+            h ^= (uint64_t)c;
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+   private:
+    struct Slot {
+        uint64_t hash = 0;
+        Key key;
+        Value value;
+        bool used = false;
+    };
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t c = 16;
+        while(c < n)
+            c <<= 1;
+        return c;
+    }
+
+    void grow() {
+        std::vector<Slot> old(slots.size() * 2);
+        old.swap(slots);
+        std::size_t mask = slots.size() - 1;
+        for(auto& s : old) {
+            if(!s.used)
+                continue;
+            std::size_t i = (std::size_t)s.hash & mask;
+            while(slots[i].used)
+                i = (i + 1) & mask;
+            slots[i] = std::move(s);
+        }
+    }
+
+    std::vector<Slot> slots;
+    std::size_t used;
+};
+
+#endif /* _OPENHASH_HPP_ */
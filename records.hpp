@@ -0,0 +1,233 @@
+/* records.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _RECORDS_HPP_
+#define _RECORDS_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <queue>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+inline FILE* open_binary(const std::filesystem::path& p, bool write) {
+#ifdef _WIN32
+    FILE* fp = NULL;
+    if(_wfopen_s(&fp, p.c_str(), write ? L"wb" : L"rb") != 0)
+        return NULL;
+#else
+    FILE* fp = fopen(p.c_str(), write ? "wb" : "rb");
+#endif
+    if(fp)
+        setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    return fp;
+}
+
+/* one listing row in binary form. nothing is formatted until the row is printed */
+struct FileRecord {
+    uint64_t size = 0;
+    int64_t atime = 0;
+    int64_t mtime = 0;
+    int64_t ctime = 0;
+    uint64_t ino = 0;
+    uint32_t mode = 0;
+    uint32_t name_off = 0; /* start of the file name in path */
+    std::filesystem::path::string_type path;
+
+    std::size_t footprint() const { return sizeof(FileRecord) + path.capacity() * sizeof(path[0]); }
+
+    /* file names compared from name_off, ties broken by the full path */
+    int compare_name(const FileRecord& o) const {
+        int c = path.compare(name_off, path.npos, o.path, o.name_off, o.path.npos);
+        return c != 0 ? c : path.compare(o.path);
+    }
+
+    bool write(FILE* fp) const {
+        uint32_t len = (uint32_t)path.size();
+        return write_fields(fp, name_off, len) && fwrite(path.data(), sizeof(path[0]), len, fp) == len;
+    }
+
+    bool read(FILE* fp) {
+        uint32_t len = 0;
+        if(!read_fields(fp, len))
+            return false;
+        path.resize(len);
+        return fread(&path[0], sizeof(path[0]), len, fp) == len;
+    }
+
+    /* the same row with the path in UTF-8, for files that are read on another host (--spool rows) */
+    bool write_utf8(FILE* fp) const {
+        std::string dir = std::filesystem::path(path.substr(0, name_off)).u8string();
+        std::string all = dir + std::filesystem::path(path.substr(name_off)).u8string();
+        uint32_t len = (uint32_t)all.size();
+        return write_fields(fp, (uint32_t)dir.size(), len) && fwrite(all.data(), 1, len, fp) == len;
+    }
+
+    bool read_utf8(FILE* fp) {
+        uint32_t len = 0;
+        if(!read_fields(fp, len))
+            return false;
+        std::string all(len, 0);
+        if(fread(&all[0], 1, len, fp) != len || name_off > len)
+            return false;
+        name_off = (uint32_t)std::filesystem::u8path(all.substr(0, name_off)).native().size();
+        path = std::filesystem::u8path(all).native();
+        return true;
+    }
+
+   private:
+    bool write_fields(FILE* fp, uint32_t off, uint32_t len) const {
+        return fwrite(&size, sizeof(size), 1, fp) == 1 && fwrite(&atime, sizeof(atime), 1, fp) == 1 &&
+               fwrite(&mtime, sizeof(mtime), 1, fp) == 1 && fwrite(&ctime, sizeof(ctime), 1, fp) == 1 &&
+               fwrite(&ino, sizeof(ino), 1, fp) == 1 && fwrite(&mode, sizeof(mode), 1, fp) == 1 &&
+               fwrite(&off, sizeof(off), 1, fp) == 1 && fwrite(&len, sizeof(len), 1, fp) == 1;
+    }
+
+    bool read_fields(FILE* fp, uint32_t& len) {
+        return fread(&size, sizeof(size), 1, fp) == 1 && fread(&atime, sizeof(atime), 1, fp) == 1 &&
+               fread(&mtime, sizeof(mtime), 1, fp) == 1 && fread(&ctime, sizeof(ctime), 1, fp) == 1 &&
+               fread(&ino, sizeof(ino), 1, fp) == 1 && fread(&mode, sizeof(mode), 1, fp) == 1 &&
+               fread(&name_off, sizeof(name_off), 1, fp) == 1 && fread(&len, sizeof(len), 1, fp) == 1;
+    }
+};
+
+/*
+ * Sorts records in memory while they fit in `budget` bytes. Past that the buffer is sorted
+ * and spilled to a temporary run file, and drain() k-way merges the runs.
+ * Rec needs footprint(), write(FILE*) and read(FILE*).
+ */
+template <typename Rec>
+class ExternalSorter {
+   public:
+    using Less = std::function<bool(const Rec&, const Rec&)>;
+    static const std::size_t MAX_FANIN = 64;
+
+    ExternalSorter(Less less, std::size_t budget, const std::filesystem::path& tmpdir = std::filesystem::path())
+        : less(std::move(less)), budget(budget), used(0), dir(tmpdir), serial(0) {
+        if(dir.empty()) {
+            std::error_code ec;
+            dir = std::filesystem::temp_directory_path(ec);
+        }
+    }
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+    ~ExternalSorter() {
+        std::error_code ec;
+        for(auto& r : runs)
+            std::filesystem::remove(r, ec);
+    }
+
+    std::size_t spilled() const { return runs.size(); }
+
+    /* false when a run could not be written */
+    bool add(Rec r) {
+        used += r.footprint();
+        buf.push_back(std::move(r));
+        return used < budget || spill();
+    }
+
+    /* calls emit(Rec&) for every record in order. false on a temporary file error */
+    template <typename F>
+    bool drain(F&& emit) {
+        if(runs.empty()) {
+            std::sort(buf.begin(), buf.end(), less);
+            for(auto& r : buf)
+                emit(r);
+            buf.clear();
+            return true;
+        }
+        if(!buf.empty() && !spill())
+            return false;
+        while(runs.size() > MAX_FANIN) {
+            std::vector<std::filesystem::path> group(runs.begin(), runs.begin() + MAX_FANIN);
+            std::filesystem::path out = next_run();
+            FILE* fp = open_binary(out, true);
+            if(fp == NULL)
+                return false;
+            bool ok = merge(group, [fp](const Rec& r) { return r.write(fp); });
+            ok = fclose(fp) == 0 && ok;
+            runs.erase(runs.begin(), runs.begin() + MAX_FANIN);
+            runs.push_back(out);
+            std::error_code ec;
+            for(auto& g : group)
+                std::filesystem::remove(g, ec);
+            if(!ok)
+                return false;
+        }
+        return merge(runs, [&emit](Rec& r) {
+            emit(r);
+            return true;
+        });
+    }
+
+   private:
+    std::filesystem::path next_run() {
+        auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+        std::string name = "lsdir-sort-" + std::to_string((uintptr_t)this) + "-" + std::to_string(stamp) + "-" +
+                           std::to_string(serial++) + ".tmp";
+        return dir / name;
+    }
+
+    bool spill() {
+        std::sort(buf.begin(), buf.end(), less);
+        std::filesystem::path out = next_run();
+        FILE* fp = open_binary(out, true);
+        if(fp == NULL)
+            return false;
+        runs.push_back(out);
+        bool ok = true;
+        for(auto& r : buf)
+            ok = ok && r.write(fp);
+        ok = fclose(fp) == 0 && ok;
+        buf.clear();
+        buf.shrink_to_fit();
+        used = 0;
+        return ok;
+    }
+
+    template <typename F>
+    bool merge(const std::vector<std::filesystem::path>& in, F&& out) {
+        struct Cursor {
+            FILE* fp;
+            Rec cur;
+        };
+        std::vector<Cursor> cur(in.size());
+        auto later = [&](std::size_t x, std::size_t y) { return less(cur[y].cur, cur[x].cur); };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> heap(later);
+
+        bool ok = true;
+        for(std::size_t i = 0; i < in.size(); ++i) {
+            cur[i].fp = open_binary(in[i], false);
+            if(cur[i].fp == NULL)
+                ok = false;
+            else if(cur[i].cur.read(cur[i].fp))
+                heap.push(i);
+        }
+        while(ok && !heap.empty()) {
+            std::size_t i = heap.top();
+            heap.pop();
+            ok = out(cur[i].cur);
+            if(cur[i].cur.read(cur[i].fp))
+                heap.push(i);
+        }
+        for(auto& c : cur) {
+            if(c.fp)
+                fclose(c.fp);
+        }
+        return ok;
+    }
+
+    Less less;
+    std::size_t budget;
+    std::size_t used;
+    std::vector<Rec> buf;
+    std::vector<std::filesystem::path> runs;
+    std::filesystem::path dir;
+    unsigned serial;
+};
+
+#endif /* _RECORDS_HPP_ */
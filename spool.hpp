@@ -0,0 +1,220 @@
+/* spool.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _SPOOL_HPP_
+#define _SPOOL_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "records.hpp"
+
+/*
+ * Work queue in a shared directory, usable by processes on one host or on several hosts
+ * mounting the same share. Every state change is a rename, which is atomic on one volume:
+ *   todo/ID       task payload, published via todo/ID.tmp
+ *   claimed/ID.C  a worker renamed it out of todo/ under its claim C, so exactly one worker
+ *                 gets each task, and a task taken back and claimed again has a new name
+ *   claimed/ID.fin  the claim is committing its result
+ *   rows/ID       the task's result rows, complete once done/ID exists
+ *   done/ID       the worker's summary of ID: what it published, and under which claim
+ * A worker keeps touching its claimed/ file. One that has not changed for LEASE as seen by
+ * another process (its own clock, so hosts need not agree on the time) belongs to a dead
+ * worker and is renamed back into todo/. If that worker was only cut off and comes back,
+ * finish() refuses it, so every task is done exactly once; what the summaries say about the
+ * tasks it published meanwhile is for the coordinator to sort out.
+ * The coordinator knows the scan is complete when it has merged as many done/ files as
+ * tasks were published in total, then creates `finished` so idle workers exit.
+ */
+class Spool {
+   public:
+    static constexpr std::chrono::seconds LEASE{60};
+
+    explicit Spool(const std::filesystem::path& dir) : root(dir), serial(0) {
+        std::random_device rd;
+        std::mt19937_64 rng(((uint64_t)rd() << 32) ^ rd() ^
+                            (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count());
+        prefix = std::to_string(rng());
+    }
+
+    /* reset empties the spool, which only the coordinator should do */
+    bool init(bool reset) {
+        std::error_code ec;
+        for(const char* d : {"todo", "claimed", "rows", "done"}) {
+            if(reset)
+                std::filesystem::remove_all(root / d, ec);
+            std::filesystem::create_directories(root / d, ec);
+            if(!std::filesystem::is_directory(root / d, ec))
+                return false;
+        }
+        if(reset)
+            std::filesystem::remove(root / "finished", ec);
+        return true;
+    }
+
+    std::string new_id() { return prefix + "-" + std::to_string(serial++); }
+
+    bool publish(const std::string& id, const std::string& payload) {
+        std::filesystem::path tmp = root / "todo" / (id + ".tmp");
+        return write_file(tmp, payload) && move(tmp, root / "todo" / id);
+    }
+
+    /* takes one task from todo/ under a new claim. false when there is none right now */
+    bool claim(std::string& id, std::string& claim, std::string& payload) {
+        std::error_code ec;
+        for(std::filesystem::directory_iterator it(root / "todo", ec), last; !ec && it != last; it.increment(ec)) {
+            std::string name = it->path().filename().string();
+            if(name.find('.') != name.npos)
+                continue;
+            std::string c = new_id();
+            std::filesystem::path claimed = root / "claimed" / (name + "." + c);
+            if(!move(it->path(), claimed))
+                continue; /* another worker was faster */
+            touch(name, c); /* the lease starts now, not when the task was published */
+            if(!read_file(claimed, payload))
+                payload.clear(); /* still returned, so the caller can finish it as a failed task */
+            id = name;
+            claim = c;
+            return true;
+        }
+        return false;
+    }
+
+    /* renews the lease of a claim. false once the task was taken back from it */
+    bool touch(const std::string& id, const std::string& claim) {
+        std::error_code ec;
+        std::filesystem::last_write_time(root / "claimed" / (id + "." + claim),
+                                         std::filesystem::file_time_type::clock::now(), ec);
+        return ec != std::errc::no_such_file_or_directory; /* other errors are left to the next try */
+    }
+
+    /* true when todo/ holds no task, so some worker is probably waiting for one */
+    bool starving() const {
+        std::error_code ec;
+        for(std::filesystem::directory_iterator it(root / "todo", ec), last; !ec && it != last; it.increment(ec)) {
+            if(it->path().filename().string().find('.') == std::string::npos)
+                return false;
+        }
+        return !ec;
+    }
+
+    /*
+     * moves claimed tasks whose lease ran out back to todo/. each file's time is compared with
+     * what this process saw before, so only the local steady clock matters. cheap to call often
+     */
+    void requeue_stale() {
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_scan < LEASE / 4)
+            return;
+        last_scan = now;
+        std::map<std::string, Seen> still;
+        std::error_code ec;
+        for(std::filesystem::directory_iterator it(root / "claimed", ec), last; !ec && it != last; it.increment(ec)) {
+            std::string name = it->path().filename().string();
+            std::string id = name.substr(0, name.find('.'));
+            std::error_code ec2;
+            if(std::filesystem::exists(root / "done" / id, ec2))
+                continue;
+            auto mtime = std::filesystem::last_write_time(it->path(), ec2);
+            if(ec2)
+                continue;
+            auto was = seen.find(name);
+            Seen s = was != seen.end() && was->second.mtime == mtime ? was->second : Seen{mtime, now};
+            if(now - s.since >= LEASE && move(it->path(), root / "todo" / id))
+                continue;
+            still[name] = s;
+        }
+        seen.swap(still);
+    }
+
+    /* result rows of a claim are written to rows_tmp, then committed by finish() */
+    std::filesystem::path rows_tmp(const std::string& id, const std::string& claim) const {
+        return root / "rows" / (id + "." + claim + ".tmp");
+    }
+    std::filesystem::path rows(const std::string& id) const { return root / "rows" / id; }
+
+    /*
+     * marks id done with summary even when its rows are missing, so the coordinator never waits
+     * on a failed task. false, with the rows dropped, when the task was taken back from this claim
+     */
+    bool finish(const std::string& id, const std::string& claim, const std::string& summary) {
+        std::error_code ec;
+        std::filesystem::path tmp = root / "done" / (id + "." + claim + ".tmp");
+        std::filesystem::path fin = root / "claimed" / (id + ".fin");
+        if(!move(root / "claimed" / (id + "." + claim), fin)) {
+            std::filesystem::remove(rows_tmp(id, claim), ec);
+            return false;
+        }
+        bool ok = move(rows_tmp(id, claim), rows(id));
+        return write_file(tmp, summary) && move(tmp, root / "done" / id) && ok;
+    }
+
+    /* ids in done/ whose rows are ready */
+    std::vector<std::string> done() const {
+        std::vector<std::string> ids;
+        std::error_code ec;
+        for(std::filesystem::directory_iterator it(root / "done", ec), last; !ec && it != last; it.increment(ec)) {
+            std::string name = it->path().filename().string();
+            if(name.find('.') == name.npos)
+                ids.push_back(name);
+        }
+        return ids;
+    }
+
+    bool summary(const std::string& id, std::string& s) const { return read_file(root / "done" / id, s) && !s.empty(); }
+
+    void remove(const std::string& id) {
+        std::error_code ec;
+        std::filesystem::remove(root / "done" / id, ec);
+        std::filesystem::remove(rows(id), ec);
+        std::filesystem::remove(root / "claimed" / (id + ".fin"), ec);
+    }
+
+    void set_finished() { write_file(root / "finished", std::string()); }
+    bool finished() const {
+        std::error_code ec;
+        return std::filesystem::exists(root / "finished", ec);
+    }
+
+   private:
+    static bool move(const std::filesystem::path& from, const std::filesystem::path& to) {
+        std::error_code ec;
+        std::filesystem::rename(from, to, ec);
+        return !ec;
+    }
+    static bool write_file(const std::filesystem::path& p, const std::string& data) {
+        FILE* fp = open_binary(p, true);
+        if(fp == NULL)
+            return false;
+        bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+        return fclose(fp) == 0 && ok;
+    }
+    static bool read_file(const std::filesystem::path& p, std::string& data) {
+        FILE* fp = open_binary(p, false);
+        if(fp == NULL)
+            return false;
+        data.clear();
+        char buf[4096];
+        for(std::size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;)
+            data.append(buf, n);
+        fclose(fp);
+        return true;
+    }
+
+    struct Seen {
+        std::filesystem::file_time_type mtime;
+        std::chrono::steady_clock::time_point since; /* when this process first saw that mtime */
+    };
+
+    std::filesystem::path root;
+    std::string prefix;
+    uint64_t serial;
+    std::map<std::string, Seen> seen;
+    std::chrono::steady_clock::time_point last_scan;
+};
+
+#endif /* _SPOOL_HPP_ */
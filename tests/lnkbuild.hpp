@@ -0,0 +1,172 @@
+/* lnkbuild.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _LNKBUILD_HPP_
+#define _LNKBUILD_HPP_
+
+/* shell links (MS-SHLLINK) built in memory for the tests, byte by byte */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "liblnk.hpp"
+
+typedef std::vector<unsigned char> Bytes;
+
+static void put16(Bytes& b, uint32_t v) {
+    b.push_back((unsigned char)v);
+    b.push_back((unsigned char)(v >> 8));
+}
+static void put32(Bytes& b, uint32_t v) {
+    put16(b, v & 0xffff);
+    put16(b, v >> 16);
+}
+static void put(Bytes& b, const std::string& s) { b.insert(b.end(), s.begin(), s.end()); }
+static void put_z(Bytes& b, const std::string& s) {
+    put(b, s);
+    b.push_back(0);
+}
+static void put_z16(Bytes& b, const std::u16string& s) {
+    for(char16_t c : s)
+        put16(b, c);
+    put16(b, 0);
+}
+static void set32(Bytes& b, std::size_t at, uint32_t v) {
+    for(int i = 0; i < 4; ++i)
+        b[at + i] = (unsigned char)(v >> (8 * i));
+}
+
+/* a StringData CountedString. utf16 strings are given as UTF-16 code units */
+static void counted(Bytes& b, const std::u16string& s, bool utf16) {
+    put16(b, (uint32_t)s.size());
+    for(char16_t c : s) {
+        if(utf16)
+            put16(b, c);
+        else
+            b.push_back((unsigned char)c);
+    }
+}
+
+struct Spec {
+    bool network = false;
+    bool utf16 = true;
+    bool info_unicode = false; /* LinkInfo and CommonNetworkRelativeLink with their Unicode strings */
+    bool environment = false;  /* an EnvironmentVariableDataBlock holding the target */
+    bool known_folder = false; /* a KnownFolderDataBlock pointing into the LinkTargetIDList */
+    bool tracker = false;      /* a TrackerDataBlock, which no rewrite touches */
+    uint16_t id_list = 20;     /* bytes of LinkTargetIDList */
+    std::string base = "C:\\dir\\file.txt";
+    std::string net = "\\\\srv\\share";
+    std::string suffix = "dir\\file.txt";
+    std::u16string description = u"desc";
+    std::u16string working_dir = u"C:\\work";
+    std::u16string arguments = u"-x 1";
+};
+
+static std::u16string widen16(const std::string& s) { return std::u16string(s.begin(), s.end()); }
+
+static Bytes build_link_info(const Spec& s) {
+    const uint32_t header = s.info_unicode ? 0x24 : 0x1c;
+    Bytes info(header, 0);
+    set32(info, 0x04, header);
+    if(!s.network) {
+        set32(info, 0x08, 1);
+        set32(info, 0x0c, (uint32_t)info.size());
+        Bytes volume(16, 0);
+        volume[0] = 0x10;
+        info.insert(info.end(), volume.begin(), volume.end());
+        set32(info, 0x10, (uint32_t)info.size());
+        put_z(info, s.base);
+        set32(info, 0x18, (uint32_t)info.size());
+        put_z(info, "");
+        if(s.info_unicode) {
+            set32(info, 0x1c, (uint32_t)info.size());
+            put_z16(info, widen16(s.base));
+            set32(info, 0x20, (uint32_t)info.size());
+            put_z16(info, u"");
+        }
+    } else {
+        set32(info, 0x08, 2);
+        const uint32_t cnr_header = s.info_unicode ? 0x1c : 0x14;
+        Bytes cnr(cnr_header, 0);
+        set32(cnr, 0x04, 3); /* ValidDevice | ValidNetType */
+        set32(cnr, 0x10, 0x20000);
+        set32(cnr, 0x08, (uint32_t)cnr.size());
+        put_z(cnr, s.net);
+        set32(cnr, 0x0c, (uint32_t)cnr.size());
+        put_z(cnr, "Z:");
+        if(s.info_unicode) {
+            set32(cnr, 0x14, (uint32_t)cnr.size());
+            put_z16(cnr, widen16(s.net));
+            set32(cnr, 0x18, (uint32_t)cnr.size());
+            put_z16(cnr, u"Z:");
+        }
+        set32(cnr, 0x00, (uint32_t)cnr.size());
+        set32(info, 0x14, (uint32_t)info.size());
+        info.insert(info.end(), cnr.begin(), cnr.end());
+        set32(info, 0x18, (uint32_t)info.size());
+        put_z(info, s.suffix);
+        if(s.info_unicode) {
+            set32(info, 0x20, (uint32_t)info.size());
+            put_z16(info, widen16(s.suffix));
+        }
+    }
+    set32(info, 0x00, (uint32_t)info.size());
+    return info;
+}
+
+static Bytes build(const Spec& s) {
+    static const unsigned char clsid[16] = {0x01, 0x14, 0x02, 0, 0, 0, 0, 0, 0xc0, 0, 0, 0, 0, 0, 0, 0x46};
+    uint32_t flags = LnkView::HAS_LINK_TARGET_ID_LIST | LnkView::HAS_LINK_INFO | LnkView::HAS_NAME |
+                     LnkView::HAS_WORKING_DIR | LnkView::HAS_ARGUMENTS | (s.utf16 ? LnkView::IS_UNICODE : 0) |
+                     (s.environment ? 0x200 : 0);
+    Bytes b;
+    put32(b, 0x4c);
+    b.insert(b.end(), clsid, clsid + 16);
+    put32(b, flags);
+    put32(b, 0x20);              /* FILE_ATTRIBUTE_ARCHIVE */
+    for(int i = 0; i < 3; ++i) { /* creation, access and write time */
+        put32(b, 0x89abcdef);
+        put32(b, 0x01d00000 + i);
+    }
+    put32(b, 1234); /* file size */
+    put32(b, 0);    /* icon index */
+    put32(b, 7);    /* SW_SHOWMINNOACTIVE */
+    put16(b, 0x0641); /* hot key */
+    b.resize(0x4c, 0);
+
+    put16(b, s.id_list);
+    b.insert(b.end(), s.id_list, 0x11);
+
+    Bytes info = build_link_info(s);
+    b.insert(b.end(), info.begin(), info.end());
+
+    counted(b, s.description, s.utf16);
+    counted(b, s.working_dir, s.utf16);
+    counted(b, s.arguments, s.utf16);
+
+    if(s.environment) {
+        Bytes env(0x314, 0);
+        set32(env, 0, 0x314);
+        set32(env, 4, 0xa0000001);
+        std::string target = s.network ? s.net + "\\" + s.suffix : s.base;
+        std::copy(target.begin(), target.end(), env.begin() + 8);
+        for(std::size_t i = 0; i < target.size(); ++i)
+            env[268 + 2 * i] = (unsigned char)target[i];
+        b.insert(b.end(), env.begin(), env.end());
+    }
+    if(s.known_folder) {
+        put32(b, 0x1c);
+        put32(b, 0xa000000b);
+        b.insert(b.end(), 16, 0x22); /* KnownFolderID */
+        put32(b, 2);                 /* offset into the IDList */
+    }
+    if(s.tracker) {
+        Bytes tracker(0x60, 0x33);
+        set32(tracker, 0, 0x60);
+        set32(tracker, 4, 0xa0000003);
+        b.insert(b.end(), tracker.begin(), tracker.end());
+    }
+    put32(b, 0); /* TerminalBlock */
+    return b;
+}
+
+#endif /* _LNKBUILD_HPP_ */
@@ -0,0 +1,220 @@
+/* lnkrewrite_test.cpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+/*
+ * LnkRewriter on links built in memory: the paths it has to replace, the bytes it has to keep,
+ * and every prefix and single bit flip of its input, which it must reject or rewrite into a link
+ * that parses again.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "liblnk.hpp"
+#include "lnkbuild.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if(!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                      \
+        }                                                                    \
+    } while(0)
+
+static bool same(const LnkText& t, const std::u16string& s) {
+    if(t.length() != s.size())
+        return false;
+    for(std::size_t i = 0; i < s.size(); ++i) {
+        if(t.at(i) != s[i])
+            return false;
+    }
+    return true;
+}
+
+static LnkRewriter rewriter(const std::string& before, const std::string& after) {
+    return LnkRewriter(before, after, widen16(before), widen16(after));
+}
+
+/* the UTF-16 string NUL terminated at iData + at */
+static std::u16string unicode_at(const Bytes& b, std::size_t at) {
+    std::u16string s;
+    for(; at + 1 < b.size() && (b[at] | b[at + 1]); at += 2)
+        s.push_back((char16_t)(b[at] | (b[at + 1] << 8)));
+    return s;
+}
+static uint32_t le32(const Bytes& b, std::size_t at) {
+    return (uint32_t)b[at] | ((uint32_t)b[at + 1] << 8) | ((uint32_t)b[at + 2] << 16) | ((uint32_t)b[at + 3] << 24);
+}
+
+/* the offset of the extra data block with the signature, 0 when there is none */
+static std::size_t block(const Bytes& b, uint32_t signature) {
+    LnkView lv;
+    if(!lv.parse(b.data(), b.size()))
+        return 0;
+    std::size_t at = lv.stringDataOffset;
+    const uint32_t fields[] = {LnkView::HAS_NAME, LnkView::HAS_RELATIVE_PATH, LnkView::HAS_WORKING_DIR,
+                               LnkView::HAS_ARGUMENTS, LnkView::HAS_ICON_LOCATION};
+    for(uint32_t f : fields) {
+        if(lv.linkFlags & f)
+            at += 2 + (b[at] | (b[at + 1] << 8)) * ((lv.linkFlags & LnkView::IS_UNICODE) ? 2 : 1);
+    }
+    while(at + 8 <= b.size() && le32(b, at) >= 8) {
+        if(le32(b, at + 4) == signature)
+            return at;
+        at += le32(b, at);
+    }
+    return 0;
+}
+
+static void test_unchanged() {
+    Bytes link = build(Spec());
+    Bytes out;
+    bool changed = true;
+    CHECK(rewriter("X:\\nowhere", "Y:\\").rewrite(link.data(), link.size(), out, changed));
+    CHECK(!changed && out.empty());
+}
+
+static void test_local() {
+    Spec s;
+    s.info_unicode = true;
+    s.environment = true;
+    s.known_folder = true;
+    s.tracker = true;
+    s.working_dir = u"C:\\dir\\work";
+    Bytes link = build(s);
+    Bytes out;
+    bool changed = false;
+    CHECK(rewriter("C:\\dir", "E:\\new\\place").rewrite(link.data(), link.size(), out, changed));
+    CHECK(changed);
+
+    LnkView before, lv;
+    CHECK(before.parse(link.data(), link.size()));
+    CHECK(lv.parse(out.data(), out.size()) && lv.complete);
+    CHECK(lv.target == "E:\\new\\place\\file.txt");
+    CHECK(same(lv.workingDirectory, u"E:\\new\\place\\work"));
+    CHECK(same(lv.description, s.description) && same(lv.arguments, s.arguments));
+
+    /* the header is copied as it is, but for the dropped LinkTargetIDList */
+    CHECK(memcmp(out.data() + 0x18, link.data() + 0x18, 0x4c - 0x18) == 0);
+    CHECK(lv.linkFlags == (before.linkFlags & ~LnkView::HAS_LINK_TARGET_ID_LIST));
+    CHECK(lv.linkInfoOffset == 0x4c);
+    CHECK(lv.creationTime == before.creationTime && lv.writeTime == before.writeTime);
+    CHECK(lv.fileAttributes == before.fileAttributes && lv.fileSize == before.fileSize);
+    CHECK(out[0x3c] == 7); /* show command */
+
+    /* the Unicode base path follows the ANSI one */
+    uint32_t info = (uint32_t)lv.linkInfoOffset;
+    CHECK(le32(out, info + 4) == 0x24);
+    CHECK(unicode_at(out, info + le32(out, info + 0x1c)) == u"E:\\new\\place\\file.txt");
+
+    /* the environment block is rewritten in place, the known folder dropped, the tracker kept */
+    std::size_t env = block(out, 0xa0000001);
+    CHECK(env && le32(out, env) == 0x314);
+    CHECK(env && strcmp((const char*)&out[env + 8], "E:\\new\\place\\file.txt") == 0);
+    CHECK(env && unicode_at(out, env + 268) == u"E:\\new\\place\\file.txt");
+    CHECK(block(link, 0xa000000b) && !block(out, 0xa000000b));
+    std::size_t tracker = block(out, 0xa0000003), old = block(link, 0xa0000003);
+    CHECK(tracker && old && memcmp(&out[tracker], &link[old], 0x60) == 0);
+}
+
+static void test_network() {
+    for(bool unicode : {false, true}) {
+        Spec s;
+        s.network = true;
+        s.info_unicode = unicode;
+        Bytes link = build(s);
+        Bytes out;
+        bool changed = false;
+        CHECK(rewriter("\\\\srv\\share", "\\\\nas01\\archive").rewrite(link.data(), link.size(), out, changed));
+        CHECK(changed);
+        LnkView lv;
+        CHECK(lv.parse(out.data(), out.size()) && lv.complete);
+        CHECK(lv.isNetwork());
+        CHECK(lv.networkPath == "\\\\nas01\\archive");
+        CHECK(lv.pathSuffix == "dir\\file.txt");
+        if(unicode) {
+            uint32_t cnr = (uint32_t)lv.linkInfoOffset + le32(out, lv.linkInfoOffset + 0x14);
+            CHECK(unicode_at(out, cnr + le32(out, cnr + 0x14)) == u"\\\\nas01\\archive");
+            CHECK(unicode_at(out, cnr + le32(out, cnr + 0x18)) == u"Z:");
+        }
+    }
+}
+
+/* only the working directory matches: LinkInfo and the LinkTargetIDList stay */
+static void test_working_dir() {
+    for(bool utf16 : {false, true}) {
+        Spec s;
+        s.utf16 = utf16;
+        s.working_dir = u"\\\\old\\work";
+        Bytes link = build(s);
+        Bytes out;
+        bool changed = false;
+        CHECK(rewriter("\\\\old", "\\\\new").rewrite(link.data(), link.size(), out, changed));
+        CHECK(changed);
+        LnkView before, lv;
+        CHECK(before.parse(link.data(), link.size()));
+        CHECK(lv.parse(out.data(), out.size()) && lv.complete);
+        CHECK(same(lv.workingDirectory, u"\\\\new\\work"));
+        CHECK(lv.linkFlags == before.linkFlags);
+        CHECK(out.size() == link.size());
+        CHECK(memcmp(out.data(), link.data(), before.stringDataOffset) == 0);
+    }
+}
+
+static void test_malformed() {
+    Bytes text(200, 'a'), out;
+    bool changed = true;
+    CHECK(!rewriter("a", "b").rewrite(text.data(), text.size(), out, changed));
+    CHECK(!changed);
+
+    /* a rewritten environment target no longer fits its 260 characters */
+    Spec s;
+    s.environment = true;
+    Bytes link = build(s);
+    CHECK(!rewriter("C:\\dir", std::string(300, 'x')).rewrite(link.data(), link.size(), out, changed));
+}
+
+/* every prefix and every single bit flip: rejected, or rewritten into a link that parses */
+static void test_damaged() {
+    LnkRewriter r = rewriter("C:\\dir", "D:\\data");
+    for(bool network : {false, true}) {
+        Spec s;
+        s.network = network;
+        s.info_unicode = true;
+        s.environment = true;
+        s.known_folder = true;
+        Bytes link = build(s);
+        Bytes out;
+        bool changed;
+        for(std::size_t n = 0; n < link.size(); ++n) {
+            Bytes copy(link.begin(), link.begin() + n);
+            CHECK(!r.rewrite(copy.data(), copy.size(), out, changed));
+        }
+        for(std::size_t i = 0; i < link.size(); ++i) {
+            for(int bit = 0; bit < 8; ++bit) {
+                Bytes flipped = link;
+                flipped[i] ^= (unsigned char)(1 << bit);
+                if(r.rewrite(flipped.data(), flipped.size(), out, changed) && changed) {
+                    LnkView lv;
+                    CHECK(lv.parse(out.data(), out.size()));
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    test_unchanged();
+    test_local();
+    test_network();
+    test_working_dir();
+    test_malformed();
+    test_damaged();
+    if(failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("lnkrewrite: ok\n");
+    return 0;
+}
@@ -0,0 +1,217 @@
+/* lnkview_test.cpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+/*
+ * LnkView on links built in memory: local, network, ANSI and UTF-16 ones, every prefix of each
+ * (a shortcut read only partly) and every single bit flipped. Whatever the bytes, parse() must
+ * stay inside the span and never allocate.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include "liblnk.hpp"
+#include "lnkbuild.hpp"
+
+static long allocations = 0;
+
+void* operator new(std::size_t n) {
+    ++allocations;
+    void* p = malloc(n ? n : 1);
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, std::size_t) noexcept { free(p); }
+
+static int failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if(!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                      \
+        }                                                                    \
+    } while(0)
+
+static bool same(const LnkText& t, const std::u16string& s) {
+    if(t.length() != s.size())
+        return false;
+    for(std::size_t i = 0; i < s.size(); ++i) {
+        if(t.at(i) != s[i])
+            return false;
+    }
+    return true;
+}
+
+static bool inside(const std::string_view& v, const unsigned char* data, std::size_t size) {
+    const char* p = v.data();
+    return v.empty() || (p >= (const char*)data && p + v.size() <= (const char*)data + size);
+}
+
+/* every view of lv lies in [data, data + size) */
+static bool contained(const LnkView& lv, const unsigned char* data, std::size_t size) {
+    return inside(lv.target, data, size) && inside(lv.networkPath, data, size) && inside(lv.pathSuffix, data, size) &&
+           inside(lv.description.bytes, data, size) && inside(lv.relativePath.bytes, data, size) &&
+           inside(lv.workingDirectory.bytes, data, size) && inside(lv.arguments.bytes, data, size) &&
+           inside(lv.iconLocation.bytes, data, size);
+}
+
+/* parses a copy of exactly size bytes, so a sanitizer catches any read past the span */
+static bool parse_copy(const Bytes& link, std::size_t size, LnkView& lv) {
+    Bytes copy(link.begin(), link.begin() + size);
+    long before = allocations;
+    bool ok = lv.parse(copy.data(), copy.size());
+    CHECK(allocations == before);
+    CHECK(contained(lv, copy.data(), copy.size()));
+    lv = LnkView(); /* the views point into copy */
+    return ok;
+}
+
+static void test_local() {
+    Spec s;
+    Bytes link = build(s);
+    LnkView lv;
+    long before = allocations;
+    CHECK(lv.parse(link.data(), link.size()));
+    CHECK(allocations == before);
+    CHECK(lv.complete);
+    CHECK(!lv.isNetwork());
+    CHECK(lv.target == "C:\\dir\\file.txt");
+    CHECK(lv.networkPath.empty());
+    CHECK(lv.pathSuffix.empty());
+    CHECK(lv.fileSize == 1234);
+    CHECK(lv.fileAttributes == 0x20);
+    CHECK(lv.writeTime == ((uint64_t)0x01d00002 << 32 | 0x89abcdef));
+    CHECK(lv.linkInfoOffset == (std::size_t)0x4c + 2 + s.id_list);
+    CHECK(lv.description.utf16 && same(lv.description, s.description));
+    CHECK(same(lv.workingDirectory, s.working_dir));
+    CHECK(same(lv.arguments, s.arguments));
+    CHECK(lv.relativePath.empty() && lv.iconLocation.empty());
+}
+
+static void test_network() {
+    Spec s;
+    s.network = true;
+    s.id_list = 9000; /* the StringData lies far past a first 8 KiB read */
+    Bytes link = build(s);
+    LnkView lv;
+    CHECK(lv.parse(link.data(), link.size()));
+    CHECK(lv.isNetwork());
+    CHECK(lv.target.empty());
+    CHECK(lv.networkPath == "\\\\srv\\share");
+    CHECK(lv.pathSuffix == "dir\\file.txt");
+    CHECK(same(lv.arguments, s.arguments));
+
+    /* LinkInfo alone, then the StringData read separately, as LnkTarget does */
+    LnkView head;
+    CHECK(head.parse(link.data(), lv.stringDataOffset));
+    CHECK(!head.complete && head.networkPath == "\\\\srv\\share");
+    CHECK(head.stringDataOffset == lv.stringDataOffset);
+    CHECK(head.parseStringData(link.data() + head.stringDataOffset, link.size() - head.stringDataOffset));
+    CHECK(same(head.workingDirectory, s.working_dir));
+}
+
+static void test_unicode() {
+    Spec s;
+    s.description = u"\u8aac\u660e \U0001F600";  /* CJK and a surrogate pair */
+    s.working_dir = u"D:\\\u30c7\u30fc\u30bf";
+    Bytes link = build(s);
+    LnkView lv;
+    CHECK(lv.parse(link.data(), link.size()));
+    CHECK(same(lv.description, s.description));
+    CHECK(lv.description.length() == 5);
+    CHECK(lv.description.at(3) == 0xd83d && lv.description.at(4) == 0xde00);
+    CHECK(same(lv.workingDirectory, s.working_dir));
+
+    Spec a;
+    a.utf16 = false;
+    a.description = u"\u00e9t\u00e9"; /* ANSI bytes 0xe9 't' 0xe9 */
+    link = build(a);
+    CHECK(lv.parse(link.data(), link.size()));
+    CHECK(!lv.description.utf16 && lv.description.bytes.size() == 3);
+    CHECK(same(lv.description, a.description));
+    CHECK(same(lv.arguments, a.arguments));
+}
+
+static void test_not_a_link() {
+    Bytes link = build(Spec());
+    LnkView lv;
+    CHECK(LnkView::isShellLink(link.data(), link.size()));
+    CHECK(!LnkView::isShellLink(link.data(), 19));
+    Bytes text(200, 'a');
+    CHECK(!LnkView::isShellLink(text.data(), text.size()));
+    CHECK(!lv.parse(text.data(), text.size()));
+    CHECK(!lv.parse(link.data(), 0));
+}
+
+/* every prefix: before the end of LinkInfo parse() fails, after it the StringData fields fill in */
+static void test_prefixes() {
+    for(bool network : {false, true}) {
+        for(bool utf16 : {false, true}) {
+            Spec s;
+            s.network = network;
+            s.utf16 = utf16;
+            Bytes link = build(s);
+            LnkView full;
+            CHECK(full.parse(link.data(), link.size()));
+            std::size_t info_end = full.stringDataOffset;
+            for(std::size_t n = 0; n <= link.size(); ++n) {
+                Bytes copy(link.begin(), link.begin() + n);
+                LnkView lv;
+                long before = allocations;
+                bool ok = lv.parse(copy.data(), copy.size());
+                CHECK(allocations == before);
+                CHECK(contained(lv, copy.data(), copy.size()));
+                CHECK(ok == (n >= info_end));
+                if(n == link.size())
+                    CHECK(lv.complete);
+                else if(n < link.size() - 4)
+                    CHECK(!lv.complete); /* only the TerminalBlock may be missing */
+            }
+        }
+    }
+}
+
+/* every bit of every byte flipped, one at a time */
+static void test_flips() {
+    for(bool network : {false, true}) {
+        Spec s;
+        s.network = network;
+        Bytes link = build(s);
+        for(std::size_t i = 0; i < link.size(); ++i) {
+            for(int bit = 0; bit < 8; ++bit) {
+                Bytes flipped = link;
+                flipped[i] ^= (unsigned char)(1 << bit);
+                LnkView lv;
+                parse_copy(flipped, flipped.size(), lv);
+                /* and the StringData on its own, from wherever it would start */
+                if(lv.parse(flipped.data(), flipped.size()) && lv.stringDataOffset <= flipped.size()) {
+                    std::size_t at = lv.stringDataOffset;
+                    Bytes tail(flipped.begin() + at, flipped.end());
+                    long before = allocations;
+                    lv.parseStringData(tail.data(), tail.size());
+                    CHECK(allocations == before);
+                    CHECK(inside(lv.description.bytes, tail.data(), tail.size()));
+                    CHECK(inside(lv.arguments.bytes, tail.data(), tail.size()));
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    test_local();
+    test_network();
+    test_unicode();
+    test_not_a_link();
+    test_prefixes();
+    test_flips();
+    if(failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("lnkview: ok\n");
+    return 0;
+}
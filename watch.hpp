@@ -0,0 +1,384 @@
+/* watch.hpp | MIT License | https://github.com/kirin123kirin/lsdir/raw/main/LICENSE */
+#ifndef _WATCH_HPP_
+#define _WATCH_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "dirwalk.hpp"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+struct WatchEvent {
+    enum Kind { CREATE, MODIFY, DELETE, RESCAN };
+    Kind kind;
+    fs::path path; /* for RESCAN the directory to list again, empty for every root */
+};
+
+inline const wchar_t* event_name(WatchEvent::Kind k) {
+    switch(k) {
+        case WatchEvent::CREATE: return L"CREATE";
+        case WatchEvent::MODIFY: return L"MODIFY";
+        case WatchEvent::DELETE: return L"DELETE";
+        default: return L"RESCAN";
+    }
+}
+
+/*
+ * Bounded queue of pending changes, coalesced per path: CREATE then DELETE cancels out,
+ * DELETE then CREATE becomes MODIFY, repeated MODIFYs collapse into one.
+ * When `capacity` paths are pending, further changes are not queued; their directory is
+ * queued for RESCAN instead, and once that set is full too every root is rescanned.
+ */
+class EventQueue {
+   public:
+    explicit EventQueue(std::size_t capacity = 65536) : capacity(capacity), rescan_all(false) {}
+
+    void push(WatchEvent::Kind kind, const fs::path& p) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if(kind == WatchEvent::RESCAN) {
+                add_rescan(p);
+            } else {
+                auto it = pending.find(p.native());
+                if(it != pending.end()) {
+                    if(!merge(it->second, kind))
+                        pending.erase(it);
+                } else if(pending.size() < capacity) {
+                    pending.emplace(p.native(), kind);
+                    order.push_back(p);
+                } else {
+                    add_rescan(p.parent_path());
+                }
+            }
+        }
+        ready.notify_one();
+    }
+
+    /* blocks until an event is available */
+    WatchEvent pop() {
+        std::unique_lock<std::mutex> lk(mtx);
+        for(;;) {
+            if(rescan_all) {
+                rescan_all = false;
+                rescans.clear();
+                rescan_order.clear();
+                return {WatchEvent::RESCAN, fs::path()};
+            }
+            if(!rescan_order.empty()) {
+                fs::path d = std::move(rescan_order.front());
+                rescan_order.pop_front();
+                rescans.erase(d.native());
+                return {WatchEvent::RESCAN, d};
+            }
+            while(!order.empty()) {
+                fs::path p = std::move(order.front());
+                order.pop_front();
+                auto it = pending.find(p.native());
+                if(it == pending.end())
+                    continue; /* cancelled, or an older duplicate of a re-queued path */
+                WatchEvent ev = {it->second, p};
+                pending.erase(it);
+                return ev;
+            }
+            ready.wait(lk);
+        }
+    }
+
+   private:
+    /* false when the two changes cancel out */
+    static bool merge(WatchEvent::Kind& was, WatchEvent::Kind now) {
+        if(now == WatchEvent::DELETE) {
+            if(was == WatchEvent::CREATE)
+                return false;
+            was = WatchEvent::DELETE;
+        } else if(was == WatchEvent::DELETE) {
+            was = WatchEvent::MODIFY;
+        }
+        return true;
+    }
+
+    void add_rescan(const fs::path& dir) {
+        if(rescan_all || rescans.count(dir.native()))
+            return;
+        if(rescans.size() >= capacity) {
+            rescan_all = true;
+            return;
+        }
+        rescans.insert(dir.native());
+        rescan_order.push_back(dir);
+    }
+
+    std::size_t capacity;
+    bool rescan_all;
+    std::unordered_map<fs::path::string_type, WatchEvent::Kind> pending;
+    std::deque<fs::path> order;
+    std::unordered_set<fs::path::string_type> rescans;
+    std::deque<fs::path> rescan_order;
+    std::mutex mtx;
+    std::condition_variable ready;
+};
+
+/*
+ * Recursive change notification feeding an EventQueue.
+ * Windows: one ReadDirectoryChangesW(bWatchSubtree) thread per root; a lost buffer rescans that root.
+ * Linux: one inotify instance with a watch per directory, added while walking the root and for
+ * every directory created later; IN_Q_OVERFLOW rescans every root. A directory that can't be
+ * watched (max_user_watches) is warned about and rescanned; one moved out of the tree is unwatched.
+ * Created directories are reported as CREATE only; listing their contents is up to the consumer.
+ */
+class Watcher {
+   public:
+    explicit Watcher(EventQueue& q) : queue(q) {
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        stop_pipe[0] = stop_pipe[1] = -1;
+        if(fd >= 0 && pipe(stop_pipe) == 0)
+            reader = std::thread([this] { loop(); });
+#endif
+    }
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+    ~Watcher() {
+#ifdef _WIN32
+        for(auto& r : roots)
+            SetEvent(r->stop);
+        for(auto& r : roots) {
+            r->thread.join();
+            CloseHandle(r->handle);
+            CloseHandle(r->stop);
+        }
+#elif defined(__linux__)
+        if(reader.joinable()) {
+            char c = 0;
+            if(write(stop_pipe[1], &c, 1) == 1)
+                reader.join();
+            else
+                reader.detach();
+        }
+        for(int p : stop_pipe) {
+            if(p >= 0)
+                close(p);
+        }
+        if(fd >= 0)
+            close(fd);
+#endif
+    }
+
+    static bool supported() {
+#if defined(_WIN32) || defined(__linux__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* starts watching root and everything below it */
+    bool add(const fs::path& root) {
+#ifdef _WIN32
+        HANDLE h = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if(h == INVALID_HANDLE_VALUE)
+            return false;
+        roots.emplace_back(new Root{root, h, CreateEventW(NULL, TRUE, FALSE, NULL), std::thread()});
+        Root* r = roots.back().get();
+        r->thread = std::thread([this, r] { loop(r); });
+        return true;
+#elif defined(__linux__)
+        if(fd < 0)
+            return false;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            root_paths.push_back(root);
+        }
+        return add_tree(root);
+#else
+        (void)root;
+        return false;
+#endif
+    }
+
+   private:
+    EventQueue& queue;
+
+#ifdef _WIN32
+    struct Root {
+        fs::path path;
+        HANDLE handle;
+        HANDLE stop;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Root>> roots;
+
+    void loop(Root* r) {
+        std::vector<DWORD> buf(64 * 1024 / sizeof(DWORD));
+        const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                             FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_CREATION;
+        OVERLAPPED ov = {0};
+        ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        for(;;) {
+            ResetEvent(ov.hEvent);
+            if(!ReadDirectoryChangesW(r->handle, buf.data(), (DWORD)(buf.size() * sizeof(DWORD)), TRUE, filter, NULL, &ov,
+                                      NULL))
+                break;
+            HANDLE waits[2] = {ov.hEvent, r->stop};
+            DWORD n = 0;
+            if(WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                CancelIoEx(r->handle, &ov);
+                GetOverlappedResult(r->handle, &ov, &n, TRUE);
+                break;
+            }
+            if(!GetOverlappedResult(r->handle, &ov, &n, FALSE)) {
+                if(GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+                    break;
+                n = 0;
+            }
+            if(n == 0) {
+                /* the kernel buffer overflowed and the changes are lost */
+                queue.push(WatchEvent::RESCAN, r->path);
+                continue;
+            }
+            for(const char* p = (const char*)buf.data();;) {
+                const FILE_NOTIFY_INFORMATION* fi = (const FILE_NOTIFY_INFORMATION*)p;
+                fs::path path = r->path / std::wstring(fi->FileName, fi->FileNameLength / sizeof(WCHAR));
+                switch(fi->Action) {
+                    case FILE_ACTION_ADDED:
+                    case FILE_ACTION_RENAMED_NEW_NAME: queue.push(WatchEvent::CREATE, path); break;
+                    case FILE_ACTION_REMOVED:
+                    case FILE_ACTION_RENAMED_OLD_NAME: queue.push(WatchEvent::DELETE, path); break;
+                    default: queue.push(WatchEvent::MODIFY, path); break;
+                }
+                if(fi->NextEntryOffset == 0)
+                    break;
+                p += fi->NextEntryOffset;
+            }
+        }
+        CloseHandle(ov.hEvent);
+    }
+#elif defined(__linux__)
+    static const uint32_t MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                                 IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+    int fd;
+    int stop_pipe[2];
+    std::thread reader;
+    std::mutex mtx;
+    std::unordered_map<int, fs::path> dirs;
+    std::vector<fs::path> root_paths;
+    bool warned = false;
+
+    bool add_tree(const fs::path& dir) {
+        int wd = inotify_add_watch(fd, dir.c_str(), MASK);
+        if(wd < 0)
+            return false;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            dirs[wd] = dir;
+        }
+        read_dir(dir, false, [this](const fs::path& p, const StatInfo& st) {
+            if(st.is_dir && !st.is_link && !add_tree(p))
+                unwatched(p);
+        });
+        return true;
+    }
+
+    /* add_tree failed for dir: unless it is already gone, say so once and have it listed again */
+    void unwatched(const fs::path& dir) {
+        if(errno == ENOENT || errno == ENOTDIR)
+            return;
+        int err = errno;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if(!warned)
+                std::wcerr << L"--watch: 監視できないフォルダがあります (" << strerror(err)
+                           << L")。fs.inotify.max_user_watches を増やしてください: " << dir.wstring() << std::endl;
+            warned = true;
+        }
+        queue.push(WatchEvent::RESCAN, dir);
+    }
+
+    /* drops the watches of dir and everything below it, after it left the tree */
+    void remove_tree(const fs::path& dir) {
+        const auto& d = dir.native();
+        std::lock_guard<std::mutex> lk(mtx);
+        for(auto it = dirs.begin(); it != dirs.end();) {
+            const auto& p = it->second.native();
+            if(p.compare(0, d.size(), d) == 0 && (p.size() == d.size() || p[d.size()] == '/')) {
+                inotify_rm_watch(fd, it->first);
+                it = dirs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void loop() {
+        alignas(struct inotify_event) char buf[64 * 1024];
+        /* directories moved away, by cookie. a MOVED_TO with the same cookie means it stayed in the tree */
+        std::unordered_map<uint32_t, fs::path> moved_out;
+        for(;;) {
+            /* both halves of a rename are queued together: a MOVED_FROM still unpaired once the queue is drained is final */
+            struct pollfd more = {fd, POLLIN, 0};
+            if(!moved_out.empty() && poll(&more, 1, 0) == 0) {
+                for(auto& m : moved_out)
+                    remove_tree(m.second);
+                moved_out.clear();
+            }
+            struct pollfd fds[2] = {{fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+            if(poll(fds, 2, -1) < 0 || fds[1].revents)
+                return;
+            ssize_t n = read(fd, buf, sizeof(buf));
+            for(char* p = buf; n > 0 && p < buf + n;) {
+                const struct inotify_event* ev = (const struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + ev->len;
+                if(ev->mask & IN_Q_OVERFLOW) {
+                    queue.push(WatchEvent::RESCAN, fs::path());
+                    continue;
+                }
+                fs::path dir;
+                {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    auto it = dirs.find(ev->wd);
+                    if(it == dirs.end())
+                        continue;
+                    dir = it->second;
+                    if(ev->mask & (IN_IGNORED | IN_DELETE_SELF)) {
+                        if(ev->mask & IN_IGNORED)
+                            dirs.erase(it);
+                        continue;
+                    }
+                }
+                fs::path path = ev->len ? dir / ev->name : dir;
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    /* watch the new directory before reporting it, so nothing created inside is missed */
+                    if(ev->mask & IN_MOVED_TO)
+                        moved_out.erase(ev->cookie);
+                    if((ev->mask & IN_ISDIR) && !add_tree(path))
+                        unwatched(path);
+                    queue.push(WatchEvent::CREATE, path);
+                } else if(ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    if((ev->mask & (IN_MOVED_FROM | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR))
+                        moved_out[ev->cookie] = path;
+                    queue.push(WatchEvent::DELETE, path);
+                } else if(ev->len) {
+                    queue.push(WatchEvent::MODIFY, path);
+                }
+            }
+        }
+    }
+#endif
+};
+
+#endif /* _WATCH_HPP_ */